@@ -1,8 +1,38 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE // splice, copy_file_range
+#endif
+
 #include "buffer.h"
+#include "common.h"
 #include <chck/overflow/overflow.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <math.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#endif
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+// pshufb kernels are compiled with target attributes and picked at runtime
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  include <immintrin.h>
+#  define HAS_PSHUFB 1
+#else
+#  define HAS_PSHUFB 0
+#endif
 
 #if HAS_ZLIB
 #  include <zlib.h>
@@ -10,6 +40,18 @@
 #  define HAS_ZLIB 0
 #endif
 
+#if HAS_LZ4
+#  include <lz4.h>
+#elif !defined(HAS_LZ4)
+#  define HAS_LZ4 0
+#endif
+
+#if HAS_ZSTD
+#  include <zstd.h>
+#elif !defined(HAS_ZSTD)
+#  define HAS_ZSTD 0
+#endif
+
 struct chck_variant {
    union {
       uint64_t u64;
@@ -21,35 +63,79 @@ struct chck_variant {
    enum chck_bits bits;
 };
 
-static inline bool
-valid_bits(enum chck_bits bits)
+#if HAS_PSHUFB
+static void
+bswap_mask(uint8_t mask[32], size_t size)
 {
-   return (bits == CHCK_BUFFER_B8  ||
-           bits == CHCK_BUFFER_B16 ||
-           bits == CHCK_BUFFER_B32 ||
-           bits == CHCK_BUFFER_B64);
+   // pshufb indexes within 128-bit lane, upper lane indices wrap by the low 4 bits
+   for (size_t i = 0; i < 32; ++i)
+      mask[i] = (i / size) * size + (size - 1 - i % size);
 }
 
-static inline enum chck_bits
-smallest_bits_for_value(uintmax_t v)
+__attribute__((target("ssse3"))) static size_t
+bswap_ssse3(uint8_t *p, size_t size, size_t memb)
 {
-   static const struct {
-      uintmax_t off;
-      enum chck_bits bits;
-   } map[3] = {
-      { ~(uint32_t)0, CHCK_BUFFER_B64 },
-      { ~(uint16_t)0, CHCK_BUFFER_B32 },
-      { ~(uint8_t)0, CHCK_BUFFER_B16 },
-   };
+   uint8_t m[32];
+   bswap_mask(m, size);
+   const __m128i mask = _mm_loadu_si128((const __m128i*)m);
 
-   for (size_t i = 0; i < sizeof(map) / sizeof(map[0]); ++i) {
-      if (v <= map[i].off)
-         continue;
+   size_t i = 0;
+   for (const size_t n = size * memb; i + 16 <= n; i += 16)
+      _mm_storeu_si128((__m128i*)(p + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + i)), mask));
+
+   return i / size;
+}
 
-      return map[i].bits;
+__attribute__((target("avx2"))) static size_t
+bswap_avx2(uint8_t *p, size_t size, size_t memb)
+{
+   uint8_t m[32];
+   bswap_mask(m, size);
+   const __m256i mask = _mm256_loadu_si256((const __m256i*)m);
+
+   size_t i = 0;
+   for (const size_t n = size * memb; i + 32 <= n; i += 32)
+      _mm256_storeu_si256((__m256i*)(p + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), mask));
+
+   return i / size;
+}
+
+static size_t
+bswap_none(uint8_t *p, size_t size, size_t memb)
+{
+   (void)p, (void)size, (void)memb;
+   return 0;
+}
+
+static size_t bswap_resolve(uint8_t *p, size_t size, size_t memb);
+static size_t (*bswap_simd)(uint8_t *p, size_t size, size_t memb) = bswap_resolve;
+
+static size_t
+bswap_resolve(uint8_t *p, size_t size, size_t memb)
+{
+   // cpu is checked on first call only, racing threads resolve to same kernel
+   __builtin_cpu_init();
+   size_t (*kernel)(uint8_t*, size_t, size_t) = (__builtin_cpu_supports("avx2") ? bswap_avx2 : (__builtin_cpu_supports("ssse3") ? bswap_ssse3 : bswap_none));
+   __atomic_store_n(&bswap_simd, kernel, __ATOMIC_RELAXED);
+   return kernel(p, size, memb);
+}
+#endif
+
+static void
+bswap_ints(void *v, enum chck_bits bits, size_t memb)
+{
+   uint8_t *p = v;
+
+#if HAS_PSHUFB
+   // less than one vector goes straight to the scalar loop
+   if (bits != CHCK_BUFFER_B8 && bits * memb >= 16) {
+      const size_t done = __atomic_load_n(&bswap_simd, __ATOMIC_RELAXED)(p, bits, memb);
+      p += done * bits;
+      memb -= done;
    }
+#endif
 
-   return CHCK_BUFFER_B8;
+   chck_bswap(p, bits, memb);
 }
 
 static inline uintmax_t
@@ -70,6 +156,18 @@ variant_get_value(struct chck_variant v)
    return 0;
 }
 
+static void
+unmap(struct chck_buffer *buf)
+{
+   assert(buf);
+
+   if (!buf->mapped)
+      return;
+
+   munmap(buf->buffer, buf->capacity);
+   buf->mapped = false;
+}
+
 void
 chck_buffer_flush(struct chck_buffer *buf)
 {
@@ -78,8 +176,10 @@ chck_buffer_flush(struct chck_buffer *buf)
    if (buf->copied)
       free(buf->buffer);
 
+   unmap(buf);
    buf->copied = false;
    buf->curpos = buf->buffer = NULL;
+   buf->size = buf->capacity = 0;
 }
 
 void
@@ -131,23 +231,125 @@ chck_buffer_set_pointer(struct chck_buffer *buf, void *ptr, size_t size, enum ch
       buf->buffer = NULL;
    }
 
+   unmap(buf);
+
    if (endianess == CHCK_ENDIANESS_NATIVE) {
       buf->endianess = chck_endianess();
    } else {
       buf->endianess = endianess;
    }
 
-   buf->size = size;
+   buf->size = buf->capacity = size;
    buf->buffer = buf->curpos = ptr;
    buf->copied = false;
 }
 
+static bool
+reallocate(struct chck_buffer *buf, size_t capacity)
+{
+   assert(buf && capacity > 0);
+
+   uint8_t *tmp;
+   if (buf->copied) {
+      if (!(tmp = realloc(buf->buffer, capacity)))
+         return false;
+   } else {
+      // buffer is not ours, so its contents are copied over
+      if (!(tmp = malloc(capacity)))
+         return false;
+
+      if (buf->buffer)
+         memcpy(tmp, buf->buffer, (buf->size < capacity ? buf->size : capacity));
+   }
+
+   /* set new buffer position */
+   const size_t pos = buf->curpos - buf->buffer;
+   unmap(buf);
+   buf->curpos = tmp + (pos > capacity ? capacity : pos);
+   buf->buffer = tmp;
+   buf->capacity = capacity;
+   buf->size = (buf->size > capacity ? capacity : buf->size);
+   buf->copied = true;
+   return true;
+}
+
+static bool
+grow(struct chck_buffer *buf, size_t needed)
+{
+   assert(buf);
+
+   size_t step = buf->capacity / 2;
+   if (buf->max_step && step > buf->max_step)
+      step = buf->max_step;
+
+   if (step < buf->step)
+      step = buf->step;
+
+   size_t capacity;
+   if (unlikely(chck_add_ofsz(buf->capacity, step, &capacity)) || capacity < needed)
+      capacity = needed;
+
+   if (!reallocate(buf, capacity))
+      return false;
+
+   assert(buf->size <= buf->capacity);
+   return true;
+}
+
+bool
+chck_buffer_from_file_mmap_with_flags(struct chck_buffer *buf, const char *path, enum chck_endianess endianess, uint32_t flags)
+{
+   assert(buf && path);
+
+   int fd;
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+      return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (uintmax_t)st.st_size > SIZE_MAX) {
+      close(fd);
+      return false;
+   }
+
+   int mflags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+   if (flags & CHCK_BUFFER_MMAP_POPULATE)
+      mflags |= MAP_POPULATE;
+#endif
+
+   // empty file can't be mapped, so it's just empty buffer
+   void *map = NULL;
+   if (st.st_size > 0 && (map = mmap(NULL, st.st_size, PROT_READ, mflags, fd, 0)) == MAP_FAILED) {
+      close(fd);
+      return false;
+   }
+
+   // mapping stays valid after close
+   close(fd);
+
+   if (map && (flags & CHCK_BUFFER_MMAP_SEQUENTIAL))
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+   if (map && (flags & CHCK_BUFFER_MMAP_WILLNEED))
+      madvise(map, st.st_size, MADV_WILLNEED);
+
+   chck_buffer_from_pointer(buf, map, st.st_size, endianess);
+   buf->mapped = (map != NULL);
+   return true;
+}
+
+bool
+chck_buffer_from_file_mmap(struct chck_buffer *buf, const char *path, enum chck_endianess endianess)
+{
+   return chck_buffer_from_file_mmap_with_flags(buf, path, endianess, CHCK_BUFFER_MMAP_SEQUENTIAL);
+}
+
 bool
 chck_buffer_resize(struct chck_buffer *buf, size_t size)
 {
    assert(buf);
 
-   if (unlikely(size == buf->size))
+   if (unlikely(size == buf->size && size == buf->capacity))
       return true;
 
    if (unlikely(size == 0)) {
@@ -155,23 +357,28 @@ chck_buffer_resize(struct chck_buffer *buf, size_t size)
       return true;
    }
 
-   uint8_t *tmp;
-   if (!(tmp = realloc((buf->copied ? buf->buffer : NULL), size)))
+   if (!reallocate(buf, size))
       return false;
 
-   /* set new buffer position */
-   if (buf->curpos - buf->buffer > (ptrdiff_t)size) {
-      buf->curpos = tmp + (buf->size - size);
-   } else {
-      buf->curpos = tmp + (buf->curpos - buf->buffer);
-   }
+   if (buf->curpos - buf->buffer > (ptrdiff_t)size)
+      buf->curpos = buf->buffer + size;
 
    buf->size = size;
-   buf->buffer = tmp;
-   buf->copied = true;
+   assert(buf->size <= buf->capacity);
    return true;
 }
 
+bool
+chck_buffer_reserve(struct chck_buffer *buf, size_t capacity)
+{
+   assert(buf);
+
+   if (capacity <= buf->capacity)
+      return true;
+
+   return reallocate(buf, capacity);
+}
+
 ptrdiff_t
 chck_buffer_seek(struct chck_buffer *buf, long offset, int whence)
 {
@@ -211,19 +418,26 @@ bounds_check(struct chck_buffer *buf, size_t size, size_t memb)
    if (unlikely(chck_mul_ofsz(size, memb, &nsz)))
       return false;
 
-   const size_t sz = buf->size - (buf->curpos - buf->buffer);
-   if (nsz > sz) {
-      /* buf->size + size * memb + buf->step */
-      if (unlikely(chck_add_ofsz(buf->size, nsz, &nsz)) || unlikely(chck_add_ofsz(buf->step, nsz, &nsz)))
-         return false;
+   /* curpos + size * memb */
+   if (unlikely(chck_add_ofsz(buf->curpos - buf->buffer, nsz, &nsz)))
+      return false;
 
-      if (!chck_buffer_resize(buf, nsz))
-         return false;
-   }
+   // mapping is read-only, so first write copies it to heap
+   if ((nsz > buf->capacity || buf->mapped) && !grow(buf, nsz))
+      return false;
 
    return true;
 }
 
+static inline void
+extend(struct chck_buffer *buf, size_t bytes)
+{
+   // size follows the end of written data, rest of the capacity is not part of the buffer
+   const size_t end = (buf->curpos - buf->buffer) + bytes;
+   if (end > buf->size)
+      buf->size = end;
+}
+
 size_t
 chck_buffer_fill(const void *src, size_t size, size_t memb, struct chck_buffer *buf)
 {
@@ -233,6 +447,7 @@ chck_buffer_fill(const void *src, size_t size, size_t memb, struct chck_buffer *
       return 0;
 
    memcpy(buf->curpos, src, size * memb);
+   extend(buf, size * memb);
    return memb;
 }
 
@@ -244,22 +459,176 @@ chck_buffer_fill_from_file(FILE *src, size_t size, size_t memb, struct chck_buff
    if (!bounds_check(buf, size, memb) || !buf->curpos || !src)
       return 0;
 
-   return fread(buf->curpos, size, memb, src);
+   memb = fread(buf->curpos, size, memb, src);
+   extend(buf, size * memb);
+   return memb;
 }
 
 size_t
 chck_buffer_fill_from_fd(int fd, size_t size, size_t memb, struct chck_buffer *buf)
 {
-   assert(fd && buf);
+   assert(fd >= 0 && buf);
 
    if (!bounds_check(buf, size, memb) || !buf->curpos)
       return 0;
 
-   const ssize_t ret = read(fd, buf->curpos, size * memb);
-   if (unlikely(ret == -1 || ret == 0))
-      return 0;
+   // short reads from pipes and sockets are continued, until end of file or nothing more without blocking
+   size_t got = 0;
+   for (const size_t want = size * memb; got < want;) {
+      const ssize_t ret = read(fd, buf->curpos + got, want - got);
+      if (ret < 0 && errno == EINTR)
+         continue;
+
+      // rest of an element that was started is waited for, so elements are never split
+      if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && got % size) {
+         struct pollfd pfd = { .fd = fd, .events = POLLIN };
+         if (poll(&pfd, 1, -1) > 0 || errno == EINTR)
+            continue;
+      }
+
+      if (ret <= 0)
+         break;
+
+      got += ret;
+   }
+
+   // partial element at end of file is dropped
+   extend(buf, got - got % size);
+   return got / size;
+}
+
+static size_t
+write_all(int fd, const uint8_t *src, size_t size)
+{
+   size_t wrote = 0;
+   while (wrote < size) {
+      const ssize_t ret = write(fd, src + wrote, size - wrote);
+      if (ret < 0 && errno == EINTR)
+         continue;
 
-   return (size_t)ret / size;
+      if (ret <= 0)
+         break;
+
+      wrote += ret;
+   }
+
+   return wrote;
+}
+
+size_t
+chck_buffer_write_to_fd(int fd, struct chck_buffer *bufs, size_t memb)
+{
+   assert(fd >= 0 && (bufs || !memb));
+
+   size_t wrote = 0, first = 0;
+   while (first < memb) {
+      // unread part of every buffer, in one writev
+      size_t n = 0;
+      struct iovec iov[IOVS];
+      for (size_t i = first; i < memb && n < IOVS; ++i) {
+         const size_t left = bufs[i].size - (bufs[i].curpos - bufs[i].buffer);
+         if (left > 0)
+            iov[n++] = (struct iovec){ .iov_base = bufs[i].curpos, .iov_len = left };
+      }
+
+      if (!n)
+         break;
+
+      size_t ret;
+      if (!(ret = writev_some(fd, iov, n)))
+         break;
+
+      wrote += ret;
+
+      // advance buffers by what was written
+      for (size_t left = ret; first < memb; ++first) {
+         const size_t avail = bufs[first].size - (bufs[first].curpos - bufs[first].buffer);
+         if (left < avail) {
+            bufs[first].curpos += left;
+            break;
+         }
+
+         bufs[first].curpos += avail;
+         left -= avail;
+      }
+   }
+
+   return wrote;
+}
+
+size_t
+chck_buffer_copy_fd(int dst, int src, size_t size)
+{
+   assert(dst >= 0 && src >= 0);
+
+   size_t moved = 0;
+
+#ifdef __linux__
+   // In-kernel copies first, each is tried until it turns out not to work with these fds.
+   enum { COPY_FILE_RANGE, SENDFILE, SPLICE, LAST };
+   for (int method = COPY_FILE_RANGE; method < LAST && moved < size;) {
+      const size_t chunk = (size - moved > (1 << 30) ? (1 << 30) : size - moved);
+
+      ssize_t ret = -1;
+      switch (method) {
+         case COPY_FILE_RANGE:
+            ret = copy_file_range(src, NULL, dst, NULL, chunk, 0);
+            break;
+         case SENDFILE:
+            ret = sendfile(dst, src, NULL, chunk);
+            break;
+         case SPLICE:
+            ret = splice(src, NULL, dst, NULL, chunk, SPLICE_F_MOVE);
+            break;
+      }
+
+      if (ret > 0) {
+         moved += ret;
+         continue;
+      }
+
+      // end of file
+      if (ret == 0)
+         return moved;
+
+      if (errno == EINTR)
+         continue;
+
+      if (errno != EINVAL && errno != ENOSYS && errno != EXDEV && errno != EOPNOTSUPP && errno != EBADF && errno != ESPIPE)
+         return moved;
+
+      ++method;
+   }
+#endif
+
+   // through user-space bounce chunk
+   enum { CHUNK = 64 * 1024 };
+   uint8_t *chunk;
+   if (moved >= size || !(chunk = malloc(CHUNK)))
+      return moved;
+
+   while (moved < size) {
+      const ssize_t ret = read(src, chunk, (size - moved > CHUNK ? CHUNK : size - moved));
+      if (ret < 0 && errno == EINTR)
+         continue;
+
+      if (ret <= 0)
+         break;
+
+      const size_t wrote = write_all(dst, chunk, ret);
+      moved += wrote;
+
+      // unwritten part is given back to seekable src, so the rest can be retried
+      if (wrote < (size_t)ret) {
+         const int error = errno;
+         lseek(src, -(off_t)(ret - wrote), SEEK_CUR);
+         errno = error;
+         break;
+      }
+   }
+
+   free(chunk);
+   return moved;
 }
 
 size_t
@@ -299,6 +668,22 @@ chck_buffer_read_int(void *i, enum chck_bits bits, struct chck_buffer *buf)
    return true;
 }
 
+size_t
+chck_buffer_read_ints(void *dst, enum chck_bits bits, size_t memb, struct chck_buffer *buf)
+{
+   assert(dst && buf);
+
+   if (!valid_bits(bits))
+      return 0;
+
+   memb = chck_buffer_read(dst, bits, memb, buf);
+
+   if (!chck_buffer_native_endianess(buf))
+      bswap_ints(dst, bits, memb);
+
+   return memb;
+}
+
 bool
 chck_buffer_read_string_of_type(char **str, size_t *out_len, enum chck_bits bits, struct chck_buffer *buf)
 {
@@ -347,6 +732,61 @@ chck_buffer_read_string(char **str, size_t *len, struct chck_buffer *buf)
    return likely(chck_buffer_read_string_of_type(str, len, bits, buf));
 }
 
+bool
+chck_buffer_read_bytes_view(const void **data, size_t len, struct chck_buffer *buf)
+{
+   assert(data && buf);
+   *data = NULL;
+
+   // all or nothing, position is left untouched on short buffer
+   if (unlikely(len > buf->size - (buf->curpos - buf->buffer)))
+      return false;
+
+   *data = (len > 0 ? buf->curpos : NULL);
+   buf->curpos += len;
+   return true;
+}
+
+bool
+chck_buffer_read_string_view_of_type(const char **str, size_t *out_len, enum chck_bits bits, struct chck_buffer *buf)
+{
+   assert(buf && str);
+   *str = NULL;
+
+   if (out_len)
+      *out_len = 0;
+
+   struct chck_variant v = { .bits = bits };
+   if (unlikely(!chck_buffer_read_int(v.b, bits, buf)))
+      return false;
+
+   const size_t len = variant_get_value(v);
+
+   if (unlikely(!chck_buffer_read_bytes_view((const void**)str, len, buf)))
+      return false;
+
+   if (out_len)
+      *out_len = len;
+
+   return true;
+}
+
+bool
+chck_buffer_read_string_view(const char **str, size_t *len, struct chck_buffer *buf)
+{
+   assert(str && buf);
+   *str = NULL;
+
+   if (len)
+      *len = 0;
+
+   uint8_t bits;
+   if (unlikely(!chck_buffer_read_int(&bits, sizeof(bits), buf)))
+      return false;
+
+   return likely(chck_buffer_read_string_view_of_type(str, len, bits, buf));
+}
+
 size_t
 chck_buffer_write(const void *src, size_t size, size_t memb, struct chck_buffer *buf)
 {
@@ -392,6 +832,26 @@ chck_buffer_write_int(const void *i, enum chck_bits bits, struct chck_buffer *bu
    return ret;
 }
 
+size_t
+chck_buffer_write_ints(const void *src, enum chck_bits bits, size_t memb, struct chck_buffer *buf)
+{
+   assert(src && buf);
+
+   if (!valid_bits(bits))
+      return 0;
+
+   if (chck_buffer_native_endianess(buf))
+      return chck_buffer_write(src, bits, memb, buf);
+
+   // swap in place after copy, so no temporary is needed
+   if (!(memb = chck_buffer_fill(src, bits, memb, buf)))
+      return 0;
+
+   bswap_ints(buf->curpos, bits, memb);
+   buf->curpos += bits * memb;
+   return memb;
+}
+
 bool
 chck_buffer_write_string_of_type(const char *str, size_t len, enum chck_bits bits, struct chck_buffer *buf)
 {
@@ -431,21 +891,272 @@ chck_buffer_write_string(const char *str, size_t len, struct chck_buffer *buf)
    return likely(chck_buffer_write_string_of_type(str, len, bits, buf));
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
-
-size_t
-chck_buffer_write_format(struct chck_buffer *buf, const char *fmt, ...)
+bool
+chck_buffer_read_varint(uint64_t *v, struct chck_buffer *buf)
 {
-   va_list argp;
-   va_start(argp, fmt);
-   const size_t wrote = chck_buffer_write_varg(buf, fmt, argp);
-   va_end(argp);
-   return wrote;
+   assert(v && buf);
+
+   size_t len;
+   if (unlikely(!(len = decode_varint(buf->curpos, buf->size - (buf->curpos - buf->buffer), v))))
+      return false;
+
+   buf->curpos += len;
+   return true;
 }
 
-size_t
-chck_buffer_write_varg(struct chck_buffer *buf, const char *fmt, va_list args)
+bool
+chck_buffer_read_varint_signed(int64_t *v, struct chck_buffer *buf)
+{
+   assert(v && buf);
+
+   uint64_t u;
+   if (unlikely(!chck_buffer_read_varint(&u, buf)))
+      return false;
+
+   *v = zigzag_decode(u);
+   return true;
+}
+
+#if HAS_PSHUFB
+// Masked VByte style decoding, continuation bits of 12 bytes pick shuffle that spreads
+// leading varints of up to 2 bytes to 16-bit lanes, or up to 4 bytes to 32-bit lanes.
+static struct varint_shuffle {
+   uint8_t shuffle[16];
+   uint8_t count, consumed, lane;
+} varint_table[1 << 12];
+
+static void
+varint_table_build(void)
+{
+   for (size_t mask = 0; mask < (1 << 12); ++mask) {
+      // lengths of varints that end within the 12 bytes
+      uint8_t lens[12];
+      size_t nlens = 0;
+      for (size_t i = 0, start = 0; i < 12; ++i) {
+         if (!(mask & (1 << i))) {
+            lens[nlens++] = i - start + 1;
+            start = i + 1;
+         }
+      }
+
+      size_t k16 = 0, k32 = 0;
+      for (; k16 < nlens && k16 < 8 && lens[k16] <= 2; ++k16);
+      for (; k32 < nlens && k32 < 4 && lens[k32] <= 4; ++k32);
+
+      struct varint_shuffle *e = &varint_table[mask];
+      e->lane = (k16 >= k32 ? 2 : 4);
+      e->count = (k16 >= k32 ? k16 : k32);
+      e->consumed = 0;
+      memset(e->shuffle, 0x80, sizeof(e->shuffle));
+
+      for (size_t i = 0; i < e->count; e->consumed += lens[i++]) {
+         for (size_t b = 0; b < lens[i]; ++b)
+            e->shuffle[i * e->lane + b] = e->consumed + b;
+      }
+   }
+}
+
+__attribute__((target("ssse3"))) static size_t
+varints_ssse3(uint64_t *dst, size_t memb, const uint8_t **out_p, const uint8_t *end)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const uint8_t *p = *out_p;
+
+   // every batch stores 8 values, even if it decodes less
+   size_t n = 0;
+   while (memb - n >= 8 && end - p >= 16) {
+      const __m128i in = _mm_loadu_si128((const __m128i*)p);
+      const int mask = _mm_movemask_epi8(in);
+
+      // no continuation bits, so 16 single byte varints
+      if (!mask && memb - n >= 16) {
+         const __m128i w[2] = { _mm_unpacklo_epi8(in, zero), _mm_unpackhi_epi8(in, zero) };
+         for (size_t i = 0; i < 2; ++i, n += 8) {
+            const __m128i lo = _mm_unpacklo_epi16(w[i], zero), hi = _mm_unpackhi_epi16(w[i], zero);
+            _mm_storeu_si128((__m128i*)(dst + n), _mm_unpacklo_epi32(lo, zero));
+            _mm_storeu_si128((__m128i*)(dst + n + 2), _mm_unpackhi_epi32(lo, zero));
+            _mm_storeu_si128((__m128i*)(dst + n + 4), _mm_unpacklo_epi32(hi, zero));
+            _mm_storeu_si128((__m128i*)(dst + n + 6), _mm_unpackhi_epi32(hi, zero));
+         }
+
+         p += 16;
+         continue;
+      }
+
+      const struct varint_shuffle *e = &varint_table[mask & 0xfff];
+
+      // first varint is longer than 4 bytes
+      if (!e->count)
+         break;
+
+      __m128i x = _mm_shuffle_epi8(in, _mm_loadu_si128((const __m128i*)e->shuffle));
+
+      if (e->lane == 2) {
+         x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi16(0x7f)), _mm_srli_epi16(_mm_and_si128(x, _mm_set1_epi16(0x7f00)), 1));
+         const __m128i lo = _mm_unpacklo_epi16(x, zero), hi = _mm_unpackhi_epi16(x, zero);
+         _mm_storeu_si128((__m128i*)(dst + n), _mm_unpacklo_epi32(lo, zero));
+         _mm_storeu_si128((__m128i*)(dst + n + 2), _mm_unpackhi_epi32(lo, zero));
+         _mm_storeu_si128((__m128i*)(dst + n + 4), _mm_unpacklo_epi32(hi, zero));
+         _mm_storeu_si128((__m128i*)(dst + n + 6), _mm_unpackhi_epi32(hi, zero));
+      } else {
+         x = _mm_or_si128(
+               _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0x7f)), _mm_srli_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7f00)), 1)),
+               _mm_or_si128(_mm_srli_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7f0000)), 2), _mm_srli_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7f000000)), 3)));
+         _mm_storeu_si128((__m128i*)(dst + n), _mm_unpacklo_epi32(x, zero));
+         _mm_storeu_si128((__m128i*)(dst + n + 2), _mm_unpackhi_epi32(x, zero));
+      }
+
+      n += e->count;
+      p += e->consumed;
+   }
+
+   *out_p = p;
+   return n;
+}
+
+static size_t
+varints_none(uint64_t *dst, size_t memb, const uint8_t **out_p, const uint8_t *end)
+{
+   (void)dst, (void)memb, (void)out_p, (void)end;
+   return 0;
+}
+
+static size_t varints_resolve(uint64_t *dst, size_t memb, const uint8_t **out_p, const uint8_t *end);
+static size_t (*varints_simd)(uint64_t *dst, size_t memb, const uint8_t **out_p, const uint8_t *end) = varints_resolve;
+
+static size_t
+varints_resolve(uint64_t *dst, size_t memb, const uint8_t **out_p, const uint8_t *end)
+{
+   // table is built by first caller, others decode without it meanwhile
+   static bool building;
+   if (__atomic_exchange_n(&building, true, __ATOMIC_ACQUIRE))
+      return 0;
+
+   __builtin_cpu_init();
+   size_t (*kernel)(uint64_t*, size_t, const uint8_t**, const uint8_t*) = varints_none;
+   if (__builtin_cpu_supports("ssse3")) {
+      varint_table_build();
+      kernel = varints_ssse3;
+   }
+
+   __atomic_store_n(&varints_simd, kernel, __ATOMIC_RELEASE);
+   return kernel(dst, memb, out_p, end);
+}
+#endif
+
+size_t
+chck_buffer_read_varints(uint64_t *dst, size_t memb, struct chck_buffer *buf)
+{
+   assert(dst && buf);
+
+   size_t n = 0;
+   const uint8_t *p = buf->curpos, *end = buf->buffer + buf->size;
+   while (n < memb) {
+#if HAS_PSHUFB
+      // batches of mixed varints of up to 4 bytes
+      size_t done;
+      if (memb - n >= 8 && end - p >= 16 && (done = __atomic_load_n(&varints_simd, __ATOMIC_ACQUIRE)(dst + n, memb - n, &p, end))) {
+         n += done;
+         continue;
+      }
+#endif
+
+#ifdef __SSE2__
+      // no continuation bits in next 16 bytes, so they are 16 single byte varints
+      if (memb - n >= 16 && end - p >= 16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p))) {
+         for (size_t i = 0; i < 16; ++i)
+            dst[n + i] = p[i];
+
+         n += 16, p += 16;
+         continue;
+      }
+#endif
+
+#if __GNUC__
+      // varint of up to 8 bytes from single load, 7-bit groups are compacted with masks and shifts
+      if (chck_endianess() == CHCK_ENDIANESS_LITTLE && end - p >= 8) {
+         uint64_t w;
+         memcpy(&w, p, sizeof(w));
+
+         const uint64_t stops = ~w & 0x8080808080808080;
+         if (stops) {
+            const size_t len = __builtin_ctzll(stops) / 8 + 1;
+            uint64_t x = (len < 8 ? w & ((UINT64_C(1) << (len * 8)) - 1) : w) & 0x7f7f7f7f7f7f7f7f;
+            x = (x & 0x007f007f007f007f) | ((x & 0x7f007f007f007f00) >> 1);
+            x = (x & 0x00003fff00003fff) | ((x & 0x3fff00003fff0000) >> 2);
+            x = (x & 0x000000000fffffff) | ((x & 0x0fffffff00000000) >> 4);
+            dst[n++] = x;
+            p += len;
+            continue;
+         }
+      }
+#endif
+
+      // 9 and 10 byte varints, end of the buffer and everything on other platforms
+      size_t len;
+      if (!(len = decode_varint(p, end - p, &dst[n])))
+         break;
+
+      ++n, p += len;
+   }
+
+   buf->curpos = (uint8_t*)p;
+   return n;
+}
+
+bool
+chck_buffer_write_varint(uint64_t v, struct chck_buffer *buf)
+{
+   assert(buf);
+   uint8_t b[VARINT_MAX];
+   const size_t len = encode_varint(v, b);
+   return likely(chck_buffer_write(b, 1, len, buf) == len);
+}
+
+bool
+chck_buffer_write_varint_signed(int64_t v, struct chck_buffer *buf)
+{
+   assert(buf);
+   return chck_buffer_write_varint(zigzag_encode(v), buf);
+}
+
+size_t
+chck_buffer_write_varints(const uint64_t *src, size_t memb, struct chck_buffer *buf)
+{
+   assert(src && buf);
+
+   // encode in chunks, so the buffer is not grown for the worst case of every value
+   uint8_t chunk[64 * VARINT_MAX];
+   size_t n = 0;
+   while (n < memb) {
+      size_t len = 0, count = 0;
+      for (; n + count < memb && len + VARINT_MAX <= sizeof(chunk); ++count)
+         len += encode_varint(src[n + count], chunk + len);
+
+      if (unlikely(chck_buffer_write(chunk, 1, len, buf) != len))
+         break;
+
+      n += count;
+   }
+
+   return n;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+size_t
+chck_buffer_write_format(struct chck_buffer *buf, const char *fmt, ...)
+{
+   va_list argp;
+   va_start(argp, fmt);
+   const size_t wrote = chck_buffer_write_varg(buf, fmt, argp);
+   va_end(argp);
+   return wrote;
+}
+
+static size_t
+write_varg_copy(struct chck_buffer *buf, const char *fmt, va_list args)
 {
    va_list cpy;
    va_copy(cpy, args);
@@ -465,8 +1176,173 @@ chck_buffer_write_varg(struct chck_buffer *buf, const char *fmt, va_list args)
    return wrote;
 }
 
+size_t
+chck_buffer_write_varg(struct chck_buffer *buf, const char *fmt, va_list args)
+{
+   assert(buf && fmt);
+
+   // Terminating NUL would overwrite data after the text, so in place only at the end of data.
+   const size_t pos = buf->curpos - buf->buffer;
+   if (pos < buf->size)
+      return write_varg_copy(buf, fmt, args);
+
+   va_list cpy;
+   va_copy(cpy, args);
+
+   // Format straight into spare capacity, on truncation grow and retry once.
+   const size_t spare = buf->capacity - pos;
+   const int len = vsnprintf((char*)buf->curpos, spare, fmt, args);
+
+   if (len >= 0 && (size_t)len >= spare) {
+      if (!bounds_check(buf, 1, (size_t)len + 1)) {
+         va_end(cpy);
+         return 0;
+      }
+
+      vsnprintf((char*)buf->curpos, (size_t)len + 1, fmt, cpy);
+   }
+
+   va_end(cpy);
+
+   if (unlikely(len <= 0))
+      return 0;
+
+   extend(buf, len);
+   buf->curpos += len;
+   return len;
+}
+
 #pragma GCC diagnostic pop
 
+static const char digits[] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+static inline size_t
+format_u64_dec(uint64_t v, char out[20])
+{
+   // backwards from the end, two digits at a time
+   char *p = out + 20;
+   for (; v >= 100; v /= 100)
+      memcpy((p -= 2), digits + (v % 100) * 2, 2);
+
+   if (v >= 10) {
+      memcpy((p -= 2), digits + v * 2, 2);
+   } else {
+      *--p = '0' + v;
+   }
+
+   memmove(out, p, out + 20 - p);
+   return out + 20 - p;
+}
+
+size_t
+chck_buffer_write_u64_dec(uint64_t v, struct chck_buffer *buf)
+{
+   assert(buf);
+   char b[20];
+   const size_t len = format_u64_dec(v, b);
+   return chck_buffer_write(b, 1, len, buf);
+}
+
+size_t
+chck_buffer_write_i64_dec(int64_t v, struct chck_buffer *buf)
+{
+   assert(buf);
+   char b[21];
+   b[0] = '-';
+
+   // negate in unsigned, so INT64_MIN does not overflow
+   const size_t len = (v < 0 ? 1 + format_u64_dec(~(uint64_t)v + 1, b + 1) : format_u64_dec(v, b));
+   return chck_buffer_write(b, 1, len, buf);
+}
+
+size_t
+chck_buffer_write_u64_hex(uint64_t v, struct chck_buffer *buf)
+{
+   assert(buf);
+
+   char b[16];
+   size_t len = 0;
+   for (int shift = 60; shift >= 0; shift -= 4) {
+      const uint8_t nibble = (v >> shift) & 0xf;
+      if (len || nibble || !shift)
+         b[len++] = "0123456789abcdef"[nibble];
+   }
+
+   return chck_buffer_write(b, 1, len, buf);
+}
+
+static inline void
+split(double v, double *hi, double *lo)
+{
+   // 2^27 + 1, halves fit 26 bits so their products are exact
+   const double c = 134217729.0 * v;
+   *hi = c - (c - v);
+   *lo = v - *hi;
+}
+
+static inline double
+two_product(double a, double b, double *err)
+{
+   // Dekker's product, a * b is exactly the result + err
+   double ah, al, bh, bl;
+   const double p = a * b;
+   split(a, &ah, &al);
+   split(b, &bh, &bl);
+   *err = ((ah * bh - p) + ah * bl + al * bh) + al * bl;
+   return p;
+}
+
+size_t
+chck_buffer_write_double(double v, uint8_t precision, struct chck_buffer *buf)
+{
+   assert(buf);
+
+   static const uint64_t pow10[] = {
+      1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+   };
+
+   // Fraction of scaled value is exact below 2^52, rest goes through printf.
+   const double a = (signbit(v) ? -v : v);
+   if (!isfinite(v) || precision >= sizeof(pow10) / sizeof(pow10[0]) || a * pow10[precision] >= 4503599627370496.0)
+      return chck_buffer_write_format(buf, "%.*f", precision, v);
+
+   // Scaling rounds, its error decides the ties, so result is what printf gives for exact value of v.
+   // Error is smaller than ulp of t, so it only matters when fraction is exactly half.
+   double err;
+   const double t = two_product(a, pow10[precision], &err);
+   uint64_t scaled = (uint64_t)t;
+   const double frac = t - scaled;
+   if (frac > 0.5 || (frac >= 0.5 && (err > 0 || (err >= 0 && (scaled & 1)))))
+      ++scaled;
+
+   char b[1 + 20 + 1 + 9];
+   size_t len = 0;
+   if (signbit(v))
+      b[len++] = '-';
+
+   len += format_u64_dec(scaled / pow10[precision], b + len);
+
+   if (precision > 0) {
+      b[len++] = '.';
+      uint64_t frac = scaled % pow10[precision];
+      for (size_t i = precision; i > 0; --i, frac /= 10)
+         b[len + i - 1] = '0' + frac % 10;
+      len += precision;
+   }
+
+   return chck_buffer_write(b, 1, len, buf);
+}
+
 bool
 chck_buffer_has_zlib(void)
 {
@@ -475,8 +1351,20 @@ chck_buffer_has_zlib(void)
 
 #pragma GCC diagnostic ignored "-Wsuggest-attribute=const"
 
-bool
-chck_buffer_compress_zlib(struct chck_buffer *buf)
+static void
+replace(struct chck_buffer *buf, uint8_t *data, size_t size, size_t capacity)
+{
+   assert(buf);
+   chck_buffer_set_pointer(buf, data, size, buf->endianess);
+   buf->capacity = capacity;
+   buf->copied = true;
+
+   if (size < capacity)
+      chck_buffer_resize(buf, size);
+}
+
+static bool
+zlib_compress(struct chck_buffer *buf, int level)
 {
 #if HAS_ZLIB
    uLongf dsize, bsize;
@@ -487,7 +1375,7 @@ chck_buffer_compress_zlib(struct chck_buffer *buf)
       return false;
 
    int ret;
-   while ((ret = compress(compressed, &dsize, buf->buffer, buf->size)) == Z_BUF_ERROR) {
+   while ((ret = compress2(compressed, &dsize, buf->buffer, buf->size, (level ? level : Z_DEFAULT_COMPRESSION))) == Z_BUF_ERROR) {
       void *tmp;
       if (!(tmp = chck_realloc_mul_of(compressed, bsize, 2)))
          goto fail;
@@ -499,16 +1387,54 @@ chck_buffer_compress_zlib(struct chck_buffer *buf)
    if (unlikely(ret != Z_OK))
       goto fail;
 
-   chck_buffer_set_pointer(buf, compressed, bsize, buf->endianess);
-   buf->copied = true;
+   replace(buf, compressed, dsize, bsize);
+   return true;
+
+fail:
+   free(compressed);
+   return false;
+#else
+   (void)buf, (void)level;
+   return false;
+#endif
+}
 
-   if (buf->size > dsize)
-      chck_buffer_resize(buf, dsize);
+bool
+chck_buffer_compress_zlib(struct chck_buffer *buf)
+{
+   assert(buf);
+   return zlib_compress(buf, 0);
+}
 
+bool
+chck_buffer_decompress_zlib(struct chck_buffer *buf)
+{
+#if HAS_ZLIB
+   if (!buf->size)
+      return false;
+
+   // Inflated once into growing buffer, twice the input is only the first guess.
+   struct chck_buffer decompressed;
+   if (!chck_buffer(&decompressed, 0, buf->endianess))
+      return false;
+
+   struct chck_buffer_zstream stream;
+   if (!chck_buffer_zstream(&stream, false, -1))
+      return false;
+
+   size_t guess;
+   const bool ret = (!chck_mul_ofsz(buf->size, 2, &guess) && chck_buffer_reserve(&decompressed, guess) &&
+                     chck_buffer_zstream_write(&stream, buf->buffer, buf->size, true, &decompressed));
+   chck_buffer_zstream_release(&stream);
+
+   if (unlikely(!ret))
+      goto fail;
+
+   replace(buf, decompressed.buffer, decompressed.size, decompressed.capacity);
    return true;
 
 fail:
-   free(compressed);
+   chck_buffer_release(&decompressed);
    return false;
 #else
    (void)buf;
@@ -517,52 +1443,359 @@ fail:
 }
 
 bool
-chck_buffer_decompress_zlib(struct chck_buffer *buf)
+chck_buffer_zstream(struct chck_buffer_zstream *stream, bool compress, int level)
 {
+   assert(stream);
+   *stream = (struct chck_buffer_zstream){ .compress = compress };
+
 #if HAS_ZLIB
-   uLongf dsize, bsize;
+   z_stream *z;
+   if (!(z = calloc(1, sizeof(z_stream))))
+      return false;
+
+   if ((compress ? deflateInit(z, level) : inflateInit(z)) != Z_OK) {
+      free(z);
+      return false;
+   }
+
+   stream->z = z;
+   return true;
+#else
+   (void)level;
+   return false;
+#endif
+}
+
+void
+chck_buffer_zstream_release(struct chck_buffer_zstream *stream)
+{
+   if (!stream)
+      return;
+
+#if HAS_ZLIB
+   if (stream->z) {
+      if (stream->compress) {
+         deflateEnd(stream->z);
+      } else {
+         inflateEnd(stream->z);
+      }
+   }
+#endif
+
+   free(stream->z);
+   *stream = (struct chck_buffer_zstream){0};
+}
+
+#if HAS_ZLIB
+static bool
+zstream_pump(struct chck_buffer_zstream *stream, const void *src, size_t size, bool finish, struct chck_buffer *dst, int fd)
+{
+   assert(stream && stream->z && (src || !size));
+
+   enum { CHUNK = 64 * 1024 };
+   uint8_t *chunk = NULL;
+   if (!dst && !(chunk = malloc(CHUNK)))
+      return false;
+
+   z_stream *z = stream->z;
+   const uint8_t *in = src;
+   bool ok = true;
+
+   // avail_in is uInt, so large inputs are fed in pieces
+   do {
+      const size_t piece = (size > UINT_MAX ? UINT_MAX : size);
+      z->next_in = (Bytef*)in;
+      z->avail_in = piece;
+      in += piece, size -= piece;
+
+      const int flush = (stream->compress && finish && !size ? Z_FINISH : Z_NO_FLUSH);
+
+      do {
+         // output goes straight to spare capacity of dst
+         if (dst) {
+            if ((dst->mapped || dst->capacity - (dst->curpos - dst->buffer) < CHUNK / 4) && !bounds_check(dst, 1, CHUNK)) {
+               ok = false;
+               break;
+            }
+
+            const size_t spare = dst->capacity - (dst->curpos - dst->buffer);
+            z->next_out = dst->curpos;
+            z->avail_out = (spare > UINT_MAX ? UINT_MAX : spare);
+         } else {
+            z->next_out = chunk;
+            z->avail_out = CHUNK;
+         }
+
+         const uInt avail = z->avail_out;
+         const int ret = (stream->compress ? deflate(z, flush) : inflate(z, flush));
+
+         if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            ok = false;
+            break;
+         }
+
+         const size_t produced = avail - z->avail_out;
+         if (dst) {
+            extend(dst, produced);
+            dst->curpos += produced;
+         } else if (write_all(fd, chunk, produced) != produced) {
+            ok = false;
+            break;
+         }
+
+         // rest of input after end of inflated stream is ignored
+         if (ret == Z_STREAM_END) {
+            stream->end = true;
+            break;
+         }
+
+         // no progress without more input
+         if (ret == Z_BUF_ERROR)
+            break;
+      } while (z->avail_out == 0 || z->avail_in > 0);
+   } while (ok && size > 0 && !stream->end);
 
-   {
-      size_t sz;
-      if (unlikely(chck_mul_ofsz(buf->size, 2, &sz)) || (uLongf)sz < sz)
+   free(chunk);
+   return ok && (!finish || stream->end || stream->compress);
+}
+#endif
+
+bool
+chck_buffer_zstream_write(struct chck_buffer_zstream *stream, const void *src, size_t size, bool finish, struct chck_buffer *dst)
+{
+   assert(stream && dst);
+#if HAS_ZLIB
+   return zstream_pump(stream, src, size, finish, dst, -1);
+#else
+   (void)stream, (void)src, (void)size, (void)finish, (void)dst;
+   return false;
+#endif
+}
+
+bool
+chck_buffer_zstream_write_to_fd(struct chck_buffer_zstream *stream, const void *src, size_t size, bool finish, int fd)
+{
+   assert(stream);
+#if HAS_ZLIB
+   return zstream_pump(stream, src, size, finish, NULL, fd);
+#else
+   (void)stream, (void)src, (void)size, (void)finish, (void)fd;
+   return false;
+#endif
+}
+
+bool
+chck_buffer_zstream_write_from_fd(struct chck_buffer_zstream *stream, int fd, bool finish, struct chck_buffer *dst)
+{
+   assert(stream && dst);
+#if HAS_ZLIB
+   uint8_t chunk[16 * 1024];
+   while (!stream->end) {
+      const ssize_t ret = read(fd, chunk, sizeof(chunk));
+      if (ret < 0 && errno == EINTR)
+         continue;
+
+      if (ret < 0)
          return false;
 
-      dsize = bsize = sz;
+      // end of file
+      if (ret == 0)
+         break;
+
+      if (!zstream_pump(stream, chunk, ret, false, dst, -1))
+         return false;
    }
 
-   if (!dsize)
+   return zstream_pump(stream, NULL, 0, finish, dst, -1);
+#else
+   (void)stream, (void)fd, (void)finish, (void)dst;
+   return false;
+#endif
+}
+
+static size_t
+zlib_bound(size_t size)
+{
+#if HAS_ZLIB
+   return ((uLong)size == size ? compressBound(size) : 0);
+#else
+   (void)size;
+   return 0;
+#endif
+}
+
+static bool
+zlib_decompress(struct chck_buffer *buf)
+{
+   return chck_buffer_decompress_zlib(buf);
+}
+
+// lz4 blocks do not know their size, so the size is prefixed as varint
+static size_t
+lz4_bound(size_t size)
+{
+#if HAS_LZ4
+   return (size <= LZ4_MAX_INPUT_SIZE ? VARINT_MAX + (size_t)LZ4_compressBound(size) : 0);
+#else
+   (void)size;
+   return 0;
+#endif
+}
+
+static bool
+lz4_compress(struct chck_buffer *buf, int level)
+{
+#if HAS_LZ4
+   size_t bound;
+   if (!(bound = lz4_bound(buf->size)))
       return false;
 
-   void *decompressed;
-   if (!(decompressed = malloc(dsize)))
+   uint8_t *compressed;
+   if (!(compressed = malloc(bound)))
       return false;
 
-   int ret;
-   while ((ret = uncompress(decompressed, &dsize, buf->buffer, buf->size)) == Z_BUF_ERROR) {
-      void *tmp;
-      if (!(tmp = chck_realloc_mul_of(decompressed, bsize, 2)))
-         goto fail;
+   // level is acceleration for lz4, higher is faster
+   const size_t header = encode_varint(buf->size, compressed);
+   const int ret = LZ4_compress_fast((const char*)buf->buffer, (char*)compressed + header, buf->size, bound - header, (level > 1 ? level : 1));
 
-      decompressed = tmp;
-      dsize = (bsize *= 2);
+   if (unlikely(ret <= 0 && buf->size > 0)) {
+      free(compressed);
+      return false;
    }
 
-   if (unlikely(ret != Z_OK))
-      goto fail;
+   replace(buf, compressed, header + ret, bound);
+   return true;
+#else
+   (void)buf, (void)level;
+   return false;
+#endif
+}
 
-   chck_buffer_set_pointer(buf, decompressed, bsize, buf->endianess);
-   buf->copied = true;
+static bool
+lz4_decompress(struct chck_buffer *buf)
+{
+#if HAS_LZ4
+   uint64_t size;
+   size_t header;
+   if (!(header = decode_varint(buf->buffer, buf->size, &size)) || size > LZ4_MAX_INPUT_SIZE)
+      return false;
 
-   if (bsize > dsize)
-      chck_buffer_resize(buf, dsize);
+   uint8_t *decompressed;
+   if (!(decompressed = malloc(size ? size : 1)))
+      return false;
 
+   const int ret = LZ4_decompress_safe((const char*)buf->buffer + header, (char*)decompressed, buf->size - header, size);
+
+   if (unlikely(ret < 0 || (uint64_t)ret != size)) {
+      free(decompressed);
+      return false;
+   }
+
+   replace(buf, decompressed, size, size);
    return true;
+#else
+   (void)buf;
+   return false;
+#endif
+}
 
-fail:
-   free(decompressed);
+static size_t
+zstd_bound(size_t size)
+{
+#if HAS_ZSTD
+   return ZSTD_compressBound(size);
+#else
+   (void)size;
+   return 0;
+#endif
+}
+
+static bool
+zstd_compress(struct chck_buffer *buf, int level)
+{
+#if HAS_ZSTD
+   const size_t bound = ZSTD_compressBound(buf->size);
+
+   uint8_t *compressed;
+   if (ZSTD_isError(bound) || !(compressed = malloc(bound)))
+      return false;
+
+   // frame header has the content size, level 0 is zstd default
+   const size_t ret = ZSTD_compress(compressed, bound, buf->buffer, buf->size, level);
+
+   if (unlikely(ZSTD_isError(ret))) {
+      free(compressed);
+      return false;
+   }
+
+   replace(buf, compressed, ret, bound);
+   return true;
+#else
+   (void)buf, (void)level;
    return false;
+#endif
+}
+
+static bool
+zstd_decompress(struct chck_buffer *buf)
+{
+#if HAS_ZSTD
+   const unsigned long long size = ZSTD_getFrameContentSize(buf->buffer, buf->size);
+   if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || (size_t)size != size)
+      return false;
+
+   uint8_t *decompressed;
+   if (!(decompressed = malloc(size ? size : 1)))
+      return false;
+
+   const size_t ret = ZSTD_decompress(decompressed, size, buf->buffer, buf->size);
+
+   if (unlikely(ZSTD_isError(ret) || ret != size)) {
+      free(decompressed);
+      return false;
+   }
+
+   replace(buf, decompressed, size, size);
+   return true;
 #else
    (void)buf;
    return false;
 #endif
 }
+
+static const struct {
+   bool available;
+   bool (*compress)(struct chck_buffer *buf, int level);
+   bool (*decompress)(struct chck_buffer *buf);
+   size_t (*bound)(size_t size);
+} codecs[CHCK_BUFFER_CODEC_LAST] = {
+   [CHCK_BUFFER_CODEC_ZLIB] = { HAS_ZLIB, zlib_compress, zlib_decompress, zlib_bound },
+   [CHCK_BUFFER_CODEC_LZ4] = { HAS_LZ4, lz4_compress, lz4_decompress, lz4_bound },
+   [CHCK_BUFFER_CODEC_ZSTD] = { HAS_ZSTD, zstd_compress, zstd_decompress, zstd_bound },
+};
+
+bool
+chck_buffer_has_codec(enum chck_buffer_codec codec)
+{
+   return (codec < CHCK_BUFFER_CODEC_LAST && codecs[codec].available);
+}
+
+size_t
+chck_buffer_codec_bound(enum chck_buffer_codec codec, size_t size)
+{
+   return (chck_buffer_has_codec(codec) ? codecs[codec].bound(size) : 0);
+}
+
+bool
+chck_buffer_compress(struct chck_buffer *buf, enum chck_buffer_codec codec, int level)
+{
+   assert(buf);
+   return (chck_buffer_has_codec(codec) && codecs[codec].compress(buf, level));
+}
+
+bool
+chck_buffer_decompress(struct chck_buffer *buf, enum chck_buffer_codec codec)
+{
+   assert(buf);
+   return (chck_buffer_has_codec(codec) && buf->size > 0 && codecs[codec].decompress(buf));
+}
@@ -15,21 +15,53 @@ enum chck_bits {
    CHCK_BUFFER_B64 = sizeof(int64_t),
 };
 
+enum chck_buffer_codec {
+   CHCK_BUFFER_CODEC_ZLIB,
+   CHCK_BUFFER_CODEC_LZ4,
+   CHCK_BUFFER_CODEC_ZSTD,
+   CHCK_BUFFER_CODEC_LAST,
+};
+
+struct chck_buffer_zstream {
+   // z_stream when zlib is available
+   void *z;
+
+   // deflate or inflate, end is set when inflate reached end of the stream
+   bool compress, end;
+};
+
 struct chck_buffer {
    // pointer to current buffer and the current position
    uint8_t *buffer, *curpos;
 
-   // size of the buffer
+   // size of the buffer, writes past the end grow it
    size_t size;
 
+   // allocated size of the buffer, never less than size
+   size_t capacity;
+
    // growth step for the buffer incase writing to full buffer
-   size_t step;
+   // capacity grows by half of itself, at least by step and at most by max_step (0 for no limit)
+   size_t step, max_step;
 
    // endianess true == big, false == little
    bool endianess;
 
    // copied == true, means that buffer is owned by this struct and will be freed on chck_buffer_release
    bool copied;
+
+   // mapped == true, means that buffer is read-only mapping of a file, unmapped on chck_buffer_release
+   // first write copies the mapping to the heap
+   bool mapped;
+};
+
+enum chck_buffer_mmap_flags {
+   // prefault the whole file (MAP_POPULATE, linux only)
+   CHCK_BUFFER_MMAP_POPULATE = 1 << 0,
+   // file is read from start to end (MADV_SEQUENTIAL)
+   CHCK_BUFFER_MMAP_SEQUENTIAL = 1 << 1,
+   // file is needed soon, read-ahead starts right away (MADV_WILLNEED)
+   CHCK_BUFFER_MMAP_WILLNEED = 1 << 2,
 };
 
 static inline bool
@@ -43,6 +75,9 @@ void chck_buffer_flush(struct chck_buffer *buf);
 bool chck_buffer_from_pointer(struct chck_buffer *buf, void *ptr, size_t size, enum chck_endianess endianess);
 bool chck_buffer(struct chck_buffer *buf, size_t size, enum chck_endianess endianess);
 void chck_buffer_set_pointer(struct chck_buffer *buf, void *ptr, size_t size, enum chck_endianess endianess);
+/* maps the file read-only, with CHCK_BUFFER_MMAP_SEQUENTIAL unless flags are given */
+bool chck_buffer_from_file_mmap(struct chck_buffer *buf, const char *path, enum chck_endianess endianess);
+bool chck_buffer_from_file_mmap_with_flags(struct chck_buffer *buf, const char *path, enum chck_endianess endianess, uint32_t flags);
 
 size_t chck_buffer_fill(const void *src, size_t size, size_t memb, struct chck_buffer *buf);
 size_t chck_buffer_fill_from_file(FILE *src, size_t size, size_t memb, struct chck_buffer *buf);
@@ -52,24 +87,78 @@ size_t chck_buffer_write(const void *src, size_t size, size_t nmemb, struct chck
 size_t chck_buffer_write_from_file(FILE *src, size_t size, size_t nmemb, struct chck_buffer *buf);
 size_t chck_buffer_write_from_fd(int fd, size_t size, size_t nmemb, struct chck_buffer *buf);
 
+/* fd functions loop until done, end of file, or EAGAIN on non-blocking fd.
+ * fill_from_fd and write_from_fd never split elements, they wait for the rest of a started element,
+ * and partial element at end of file is dropped.
+ * write_to_fd writes unread part of every buffer with writev and advances their curpos, returns bytes written.
+ * copy_fd moves data between fds in kernel with copy_file_range, sendfile or splice when possible, returns bytes moved.
+ * if write fails after read, unwritten part is seeked back in src when src is seekable. */
+size_t chck_buffer_write_to_fd(int fd, struct chck_buffer *bufs, size_t memb);
+size_t chck_buffer_copy_fd(int dst, int src, size_t size);
+
 size_t chck_buffer_read(void *dst, size_t size, size_t memb, struct chck_buffer *buf);
 bool chck_buffer_read_int(void *i, enum chck_bits bits, struct chck_buffer *buf);
+size_t chck_buffer_read_ints(void *dst, enum chck_bits bits, size_t memb, struct chck_buffer *buf);
 bool chck_buffer_read_string(char **str, size_t *len, struct chck_buffer *buf);
 bool chck_buffer_read_string_of_type(char **str, size_t *len, enum chck_bits bits, struct chck_buffer *buf);
 
+/* views point into the buffer without copying, valid until buffer is resized or released, strings are not NUL terminated.
+ * string views pair with chck_string_set_cstr_with_length(string, str, len, false) */
+bool chck_buffer_read_bytes_view(const void **data, size_t len, struct chck_buffer *buf);
+bool chck_buffer_read_string_view(const char **str, size_t *len, struct chck_buffer *buf);
+bool chck_buffer_read_string_view_of_type(const char **str, size_t *len, enum chck_bits bits, struct chck_buffer *buf);
+
 bool chck_buffer_write_int(const void *i, enum chck_bits bits, struct chck_buffer *buf);
+size_t chck_buffer_write_ints(const void *src, enum chck_bits bits, size_t memb, struct chck_buffer *buf);
 bool chck_buffer_write_string(const char *str, size_t len, struct chck_buffer *buf);
 bool chck_buffer_write_string_of_type(const char *str, size_t len, enum chck_bits bits, struct chck_buffer *buf);
 
+/* LEB128 varints, signed ones are zigzag encoded, byte order does not depend on endianess.
+ * chck_buffer_read_varints decodes runs of up to 4 byte varints with SSSE3 shuffles when available,
+ * and may write past returned count within memb. */
+bool chck_buffer_read_varint(uint64_t *v, struct chck_buffer *buf);
+bool chck_buffer_read_varint_signed(int64_t *v, struct chck_buffer *buf);
+size_t chck_buffer_read_varints(uint64_t *dst, size_t memb, struct chck_buffer *buf);
+bool chck_buffer_write_varint(uint64_t v, struct chck_buffer *buf);
+bool chck_buffer_write_varint_signed(int64_t v, struct chck_buffer *buf);
+size_t chck_buffer_write_varints(const uint64_t *src, size_t memb, struct chck_buffer *buf);
+
 CHCK_FORMAT(printf, 2, 3) size_t chck_buffer_write_format(struct chck_buffer *buf, const char *fmt, ...);
 size_t chck_buffer_write_varg(struct chck_buffer *buf, const char *fmt, va_list args);
 
+/* text without printf, return number of bytes written, 0 on failure.
+ * doubles match printf "%.*f" for every value, scaled values from 2^52 up and precision over 9 go through printf */
+size_t chck_buffer_write_u64_dec(uint64_t v, struct chck_buffer *buf);
+size_t chck_buffer_write_i64_dec(int64_t v, struct chck_buffer *buf);
+size_t chck_buffer_write_u64_hex(uint64_t v, struct chck_buffer *buf);
+size_t chck_buffer_write_double(double v, uint8_t precision, struct chck_buffer *buf);
+
 ptrdiff_t chck_buffer_seek(struct chck_buffer *buf, long offset, int whence);
 bool chck_buffer_resize(struct chck_buffer *buf, size_t size);
+bool chck_buffer_reserve(struct chck_buffer *buf, size_t capacity);
 
 /* -DHAS_ZLIB=1 -lz */
 bool chck_buffer_has_zlib(void);
 bool chck_buffer_compress_zlib(struct chck_buffer *buf);
 bool chck_buffer_decompress_zlib(struct chck_buffer *buf);
 
+/* -DHAS_LZ4=1 -llz4, -DHAS_ZSTD=1 -lzstd
+ * whole buffer is replaced with its compressed or decompressed contents.
+ * level is codec specific, 0 for codec default, acceleration for lz4. lz4 blocks are prefixed with varint of their size.
+ * bound is the worst case compressed size, 0 when codec is not available */
+bool chck_buffer_has_codec(enum chck_buffer_codec codec);
+size_t chck_buffer_codec_bound(enum chck_buffer_codec codec, size_t size);
+bool chck_buffer_compress(struct chck_buffer *buf, enum chck_buffer_codec codec, int level);
+bool chck_buffer_decompress(struct chck_buffer *buf, enum chck_buffer_codec codec);
+
+/* streaming deflate (compress == true) or inflate, level is zlib compression level, -1 for default.
+ * output is appended at curpos of dst or written to fd as input is fed in, finish ends the deflate stream,
+ * and for inflate fails unless end of the stream was reached. */
+bool chck_buffer_zstream(struct chck_buffer_zstream *stream, bool compress, int level);
+void chck_buffer_zstream_release(struct chck_buffer_zstream *stream);
+bool chck_buffer_zstream_write(struct chck_buffer_zstream *stream, const void *src, size_t size, bool finish, struct chck_buffer *dst);
+bool chck_buffer_zstream_write_to_fd(struct chck_buffer_zstream *stream, const void *src, size_t size, bool finish, int fd);
+/* feeds everything read from fd until end of file */
+bool chck_buffer_zstream_write_from_fd(struct chck_buffer_zstream *stream, int fd, bool finish, struct chck_buffer *dst);
+
 #endif /* __chck_buffer__ */
@@ -0,0 +1,103 @@
+#ifndef __chck_buffer_common__
+#define __chck_buffer_common__
+
+/* helpers shared by buffer.c and rope.c, not installed */
+
+#include "buffer.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+enum {
+   VARINT_MAX = 10, // ceil(64 / 7)
+   IOVS = 64, // iovecs per writev
+};
+
+static inline bool
+valid_bits(enum chck_bits bits)
+{
+   return (bits == CHCK_BUFFER_B8  ||
+           bits == CHCK_BUFFER_B16 ||
+           bits == CHCK_BUFFER_B32 ||
+           bits == CHCK_BUFFER_B64);
+}
+
+static inline enum chck_bits
+smallest_bits_for_value(uintmax_t v)
+{
+   static const struct {
+      uintmax_t off;
+      enum chck_bits bits;
+   } map[3] = {
+      { ~(uint32_t)0, CHCK_BUFFER_B64 },
+      { ~(uint16_t)0, CHCK_BUFFER_B32 },
+      { ~(uint8_t)0, CHCK_BUFFER_B16 },
+   };
+
+   for (size_t i = 0; i < sizeof(map) / sizeof(map[0]); ++i) {
+      if (v <= map[i].off)
+         continue;
+
+      return map[i].bits;
+   }
+
+   return CHCK_BUFFER_B8;
+}
+
+static inline uint64_t
+zigzag_encode(int64_t v)
+{
+   return ((uint64_t)v << 1) ^ (v < 0 ? ~(uint64_t)0 : 0);
+}
+
+static inline int64_t
+zigzag_decode(uint64_t v)
+{
+   return (int64_t)((v >> 1) ^ (~(v & 1) + 1));
+}
+
+static inline size_t
+encode_varint(uint64_t v, uint8_t out[VARINT_MAX])
+{
+   size_t len = 0;
+   for (; v >= 0x80; v >>= 7)
+      out[len++] = (v & 0x7f) | 0x80;
+
+   out[len++] = v;
+   return len;
+}
+
+static inline size_t
+decode_varint(const uint8_t *p, size_t avail, uint64_t *out_v)
+{
+   uint64_t v = 0;
+   for (size_t i = 0; i < avail && i < VARINT_MAX; ++i) {
+      // 10th byte has room for the 64th bit only
+      if (i == VARINT_MAX - 1 && (p[i] & 0x7e))
+         return 0;
+
+      v |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+
+      if (!(p[i] & 0x80)) {
+         *out_v = v;
+         return i + 1;
+      }
+   }
+
+   // truncated or longer than 64 bits
+   return 0;
+}
+
+static inline size_t
+writev_some(int fd, const struct iovec *iov, size_t n)
+{
+   assert(n <= IOVS);
+
+   ssize_t ret;
+   while ((ret = writev(fd, iov, n)) < 0 && errno == EINTR);
+
+   // 0 when nothing more without blocking, or error
+   return (ret > 0 ? (size_t)ret : 0);
+}
+
+#endif /* __chck_buffer_common__ */
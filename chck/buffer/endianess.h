@@ -110,8 +110,28 @@ chck_bswap(void *v, size_t size, size_t memb)
 {
    assert(v);
 
-   for (uint8_t *p = v; size > sizeof(uint8_t) && p < (uint8_t*)v + (memb * size); p += size)
-      chck_bswap_single(p, size);
+   if (size <= sizeof(uint8_t))
+      return;
+
+   // size is dispatched once instead of per element
+   uint8_t *p = v, *end = p + memb * size;
+   switch (size) {
+#if HAS_BYTESWAP
+      case sizeof(uint16_t):
+         for (uint16_t t; p < end; p += size) { memcpy(&t, p, size); t = bswap16(t); memcpy(p, &t, size); }
+         break;
+      case sizeof(uint32_t):
+         for (uint32_t t; p < end; p += size) { memcpy(&t, p, size); t = bswap32(t); memcpy(p, &t, size); }
+         break;
+      case sizeof(uint64_t):
+         for (uint64_t t; p < end; p += size) { memcpy(&t, p, size); t = bswap64(t); memcpy(p, &t, size); }
+         break;
+#endif
+      default:
+         for (; p < end; p += size)
+            chck_bswap_generic(p, size);
+         break;
+   }
 }
 
 /** define chck_bswap{16,32,64} for use **/
@@ -0,0 +1,651 @@
+#include "rope.h"
+#include "common.h"
+#include <chck/overflow/overflow.h>
+#include <stdlib.h>
+
+enum {
+   SEGMENT_MIN = 4096,
+};
+
+static inline bool
+native_endianess(const struct chck_rope *rope)
+{
+   return (chck_endianess() == rope->endianess);
+}
+
+static inline enum chck_endianess
+endianess(const struct chck_rope *rope)
+{
+   return (rope->endianess ? CHCK_ENDIANESS_BIG : CHCK_ENDIANESS_LITTLE);
+}
+
+static inline void
+restore(struct chck_rope *rope, const struct chck_rope *start)
+{
+   rope->position = start->position;
+   rope->segment = start->segment;
+   rope->offset = start->offset;
+}
+
+static struct chck_rope_segment*
+add_segment(struct chck_rope *rope)
+{
+   assert(rope);
+
+   if (rope->count >= rope->allocated) {
+      const size_t allocated = (rope->allocated ? rope->allocated * 2 : 8);
+
+      void *tmp;
+      if (!(tmp = chck_realloc_mul_of(rope->segments, allocated, sizeof(struct chck_rope_segment))))
+         return NULL;
+
+      rope->segments = tmp;
+      rope->allocated = allocated;
+   }
+
+   struct chck_rope_segment *segment = &rope->segments[rope->count++];
+   *segment = (struct chck_rope_segment){0};
+   return segment;
+}
+
+static void
+advance(struct chck_rope *rope, uint8_t *dst, size_t size)
+{
+   assert(rope && size <= rope->size - rope->position);
+
+   // copies out to dst, if any, caller has checked there is enough data
+   while (size > 0) {
+      const struct chck_rope_segment *segment = &rope->segments[rope->segment];
+
+      if (rope->offset == segment->size) {
+         ++rope->segment;
+         rope->offset = 0;
+         continue;
+      }
+
+      const size_t n = (segment->size - rope->offset < size ? segment->size - rope->offset : size);
+
+      if (dst) {
+         memcpy(dst, segment->data + rope->offset, n);
+         dst += n;
+      }
+
+      rope->offset += n;
+      rope->position += n;
+      size -= n;
+   }
+}
+
+static const uint8_t*
+contiguous(struct chck_rope *rope, size_t *out_avail)
+{
+   assert(rope && out_avail);
+   *out_avail = 0;
+
+   if (!rope->count)
+      return NULL;
+
+   // read position stays on last segment, so appends to owned tail are seen
+   while (rope->offset == rope->segments[rope->segment].size && rope->segment + 1 < rope->count) {
+      ++rope->segment;
+      rope->offset = 0;
+   }
+
+   const struct chck_rope_segment *segment = &rope->segments[rope->segment];
+   *out_avail = segment->size - rope->offset;
+   return segment->data + rope->offset;
+}
+
+static uint8_t*
+append(struct chck_rope *rope, size_t size)
+{
+   assert(rope && size > 0);
+
+   struct chck_rope_segment *last = (rope->count > 0 ? &rope->segments[rope->count - 1] : NULL);
+
+   if (!last || !last->owned || last->capacity - last->size < size) {
+      const size_t capacity = (size > SEGMENT_MIN ? size : SEGMENT_MIN);
+
+      uint8_t *data;
+      if (!(data = malloc(capacity)))
+         return NULL;
+
+      if (!(last = add_segment(rope))) {
+         free(data);
+         return NULL;
+      }
+
+      *last = (struct chck_rope_segment){ .data = data, .capacity = capacity, .owned = true };
+   }
+
+   uint8_t *p = last->data + last->size;
+   last->size += size;
+   rope->size += size;
+   return p;
+}
+
+bool
+chck_rope(struct chck_rope *rope, enum chck_endianess endianess)
+{
+   assert(rope);
+   *rope = (struct chck_rope){0};
+   rope->endianess = (endianess == CHCK_ENDIANESS_NATIVE ? chck_endianess() : endianess);
+   return true;
+}
+
+void
+chck_rope_release(struct chck_rope *rope)
+{
+   if (!rope)
+      return;
+
+   for (size_t i = 0; i < rope->count; ++i) {
+      if (rope->segments[i].owned)
+         free(rope->segments[i].data);
+   }
+
+   free(rope->segments);
+   *rope = (struct chck_rope){0};
+}
+
+size_t
+chck_rope_write(const void *src, size_t size, size_t memb, struct chck_rope *rope)
+{
+   assert(src && rope);
+
+   size_t nsz;
+   if (unlikely(chck_mul_ofsz(size, memb, &nsz)))
+      return 0;
+
+   if (!nsz)
+      return memb;
+
+   uint8_t *p;
+   if (!(p = append(rope, nsz)))
+      return 0;
+
+   memcpy(p, src, nsz);
+   return memb;
+}
+
+bool
+chck_rope_write_ref(const void *src, size_t size, struct chck_rope *rope)
+{
+   assert(src && rope);
+
+   if (!size)
+      return true;
+
+   struct chck_rope_segment *segment;
+   if (!(segment = add_segment(rope)))
+      return false;
+
+   // referenced segments are never appended to
+   *segment = (struct chck_rope_segment){ .data = (uint8_t*)src, .size = size, .capacity = size };
+   rope->size += size;
+   return true;
+}
+
+bool
+chck_rope_write_int(const void *i, enum chck_bits bits, struct chck_rope *rope)
+{
+   assert(i && rope);
+
+   if (!valid_bits(bits))
+      return false;
+
+   if (native_endianess(rope))
+      return (chck_rope_write(i, bits, 1, rope) == 1);
+
+   uint8_t b[sizeof(uint64_t)];
+   memcpy(b, i, bits);
+   chck_bswap_single(b, bits);
+   return (chck_rope_write(b, bits, 1, rope) == 1);
+}
+
+size_t
+chck_rope_write_ints(const void *src, enum chck_bits bits, size_t memb, struct chck_rope *rope)
+{
+   assert(src && rope);
+
+   size_t nsz;
+   if (!valid_bits(bits) || unlikely(chck_mul_ofsz(bits, memb, &nsz)))
+      return 0;
+
+   if (!nsz)
+      return memb;
+
+   uint8_t *p;
+   if (!(p = append(rope, nsz)))
+      return 0;
+
+   // swapped by chck_buffer view of the appended bytes
+   struct chck_buffer view;
+   chck_buffer_from_pointer(&view, p, nsz, endianess(rope));
+   return chck_buffer_write_ints(src, bits, memb, &view);
+}
+
+bool
+chck_rope_write_varint(uint64_t v, struct chck_rope *rope)
+{
+   assert(rope);
+   uint8_t b[VARINT_MAX];
+   const size_t len = encode_varint(v, b);
+   return likely(chck_rope_write(b, 1, len, rope) == len);
+}
+
+bool
+chck_rope_write_varint_signed(int64_t v, struct chck_rope *rope)
+{
+   assert(rope);
+   return chck_rope_write_varint(zigzag_encode(v), rope);
+}
+
+size_t
+chck_rope_write_varints(const uint64_t *src, size_t memb, struct chck_rope *rope)
+{
+   assert(src && rope);
+
+   uint8_t chunk[64 * VARINT_MAX];
+   size_t n = 0;
+   while (n < memb) {
+      size_t len = 0, count = 0;
+      for (; n + count < memb && len + VARINT_MAX <= sizeof(chunk); ++count)
+         len += encode_varint(src[n + count], chunk + len);
+
+      if (unlikely(chck_rope_write(chunk, 1, len, rope) != len))
+         break;
+
+      n += count;
+   }
+
+   return n;
+}
+
+bool
+chck_rope_write_string_of_type(const char *str, size_t len, enum chck_bits bits, struct chck_rope *rope)
+{
+   assert(rope);
+
+   bool ret = false;
+   switch (bits) {
+      case CHCK_BUFFER_B8:
+         ret = chck_rope_write_int((uint8_t[]){len}, bits, rope);
+         break;
+      case CHCK_BUFFER_B16:
+         ret = chck_rope_write_int((uint16_t[]){len}, bits, rope);
+         break;
+      case CHCK_BUFFER_B32:
+         ret = chck_rope_write_int((uint32_t[]){len}, bits, rope);
+         break;
+      case CHCK_BUFFER_B64:
+         ret = chck_rope_write_int((uint64_t[]){len}, bits, rope);
+         break;
+   }
+
+   if (unlikely(!ret))
+      return false;
+
+   return likely(!len || chck_rope_write(str, 1, len, rope) == len);
+}
+
+bool
+chck_rope_write_string(const char *str, size_t len, struct chck_rope *rope)
+{
+   assert(rope);
+
+   const uint8_t bits = smallest_bits_for_value(len);
+   if (unlikely(!chck_rope_write_int(&bits, sizeof(bits), rope)))
+      return false;
+
+   return likely(chck_rope_write_string_of_type(str, len, bits, rope));
+}
+
+size_t
+chck_rope_read(void *dst, size_t size, size_t memb, struct chck_rope *rope)
+{
+   assert(dst && rope);
+
+   size_t nsz;
+   if (unlikely(chck_mul_ofsz(size, memb, &nsz)))
+      return 0;
+
+   if (unlikely(nsz > rope->size - rope->position)) {
+      assert(size != 0); // should never happen
+      // read as much as we can
+      memb = (rope->size - rope->position) / size;
+   }
+
+   advance(rope, dst, size * memb);
+   return memb;
+}
+
+bool
+chck_rope_read_int(void *i, enum chck_bits bits, struct chck_rope *rope)
+{
+   assert(i && rope);
+
+   if (!valid_bits(bits))
+      return false;
+
+   if (unlikely(chck_rope_read(i, bits, 1, rope) != 1))
+      return false;
+
+   if (!native_endianess(rope))
+      chck_bswap_single(i, bits);
+
+   return true;
+}
+
+size_t
+chck_rope_read_ints(void *dst, enum chck_bits bits, size_t memb, struct chck_rope *rope)
+{
+   assert(dst && rope);
+
+   if (!valid_bits(bits))
+      return 0;
+
+   // whole elements within segment are swapped by chck_buffer view of it, one spanning segments alone
+   size_t n = 0;
+   for (uint8_t *out = dst; n < memb;) {
+      size_t avail;
+      const uint8_t *p = contiguous(rope, &avail);
+      const size_t k = (avail / bits < memb - n ? avail / bits : memb - n);
+
+      if (k > 0) {
+         struct chck_buffer view;
+         chck_buffer_from_pointer(&view, (void*)p, k * bits, endianess(rope));
+         chck_buffer_read_ints(out + n * bits, bits, k, &view);
+         advance(rope, NULL, k * bits);
+         n += k;
+      } else if (chck_rope_read_int(out + n * bits, bits, rope)) {
+         ++n;
+      } else {
+         break;
+      }
+   }
+
+   return n;
+}
+
+bool
+chck_rope_read_bytes_view(const void **data, size_t len, struct chck_rope *rope)
+{
+   assert(data && rope);
+   *data = NULL;
+
+   if (!len)
+      return true;
+
+   // all or nothing, position is left untouched on short rope or when bytes span segments
+   size_t avail;
+   const uint8_t *p = contiguous(rope, &avail);
+   if (len > avail)
+      return false;
+
+   *data = p;
+   advance(rope, NULL, len);
+   return true;
+}
+
+bool
+chck_rope_read_string_view_of_type(const char **str, size_t *out_len, enum chck_bits bits, struct chck_rope *rope)
+{
+   assert(rope && str);
+   *str = NULL;
+
+   if (out_len)
+      *out_len = 0;
+
+   union {
+      uint64_t u64;
+      uint32_t u32;
+      uint16_t u16;
+      uint8_t u8;
+   } v = {0};
+
+   const struct chck_rope start = *rope;
+   if (unlikely(!chck_rope_read_int(&v, bits, rope)))
+      return false;
+
+   const size_t len = (bits == CHCK_BUFFER_B8 ? v.u8 : (bits == CHCK_BUFFER_B16 ? v.u16 : (bits == CHCK_BUFFER_B32 ? v.u32 : v.u64)));
+
+   // length is given back too, so string can be read again after flatten
+   if (unlikely(!chck_rope_read_bytes_view((const void**)str, len, rope))) {
+      restore(rope, &start);
+      return false;
+   }
+
+   if (out_len)
+      *out_len = len;
+
+   return true;
+}
+
+bool
+chck_rope_read_string_view(const char **str, size_t *len, struct chck_rope *rope)
+{
+   assert(str && rope);
+   *str = NULL;
+
+   if (len)
+      *len = 0;
+
+   const struct chck_rope start = *rope;
+
+   uint8_t bits;
+   if (unlikely(!chck_rope_read_int(&bits, sizeof(bits), rope)))
+      return false;
+
+   if (unlikely(!chck_rope_read_string_view_of_type(str, len, bits, rope))) {
+      restore(rope, &start);
+      return false;
+   }
+
+   return true;
+}
+
+bool
+chck_rope_read_string_of_type(char **str, size_t *out_len, enum chck_bits bits, struct chck_rope *rope)
+{
+   assert(rope && str);
+   *str = NULL;
+
+   if (out_len)
+      *out_len = 0;
+
+   union {
+      uint64_t u64;
+      uint32_t u32;
+      uint16_t u16;
+      uint8_t u8;
+   } v = {0};
+
+   if (unlikely(!chck_rope_read_int(&v, bits, rope)))
+      return false;
+
+   const size_t len = (bits == CHCK_BUFFER_B8 ? v.u8 : (bits == CHCK_BUFFER_B16 ? v.u16 : (bits == CHCK_BUFFER_B32 ? v.u32 : v.u64)));
+
+   if (out_len)
+      *out_len = len;
+
+   if (len <= 0)
+      return true;
+
+   if (!(*str = chck_calloc_add_of(len, 1)))
+      return false;
+
+   if (unlikely(chck_rope_read(*str, 1, len, rope) != len)) {
+      free(*str);
+      *str = NULL;
+      return false;
+   }
+
+   return true;
+}
+
+bool
+chck_rope_read_string(char **str, size_t *len, struct chck_rope *rope)
+{
+   assert(str && rope);
+   *str = NULL;
+
+   if (len)
+      *len = 0;
+
+   uint8_t bits;
+   if (unlikely(!chck_rope_read_int(&bits, sizeof(bits), rope)))
+      return false;
+
+   return likely(chck_rope_read_string_of_type(str, len, bits, rope));
+}
+
+bool
+chck_rope_read_varint(uint64_t *v, struct chck_rope *rope)
+{
+   assert(v && rope);
+
+   // peek bytes for the longest varint, they may span segments
+   const struct chck_rope start = *rope;
+   uint8_t b[VARINT_MAX];
+   const size_t avail = chck_rope_read(b, 1, sizeof(b), rope);
+   restore(rope, &start);
+
+   // position is left untouched on truncated or overlong varint
+   size_t len;
+   if (unlikely(!(len = decode_varint(b, avail, v))))
+      return false;
+
+   advance(rope, NULL, len);
+   return true;
+}
+
+bool
+chck_rope_read_varint_signed(int64_t *v, struct chck_rope *rope)
+{
+   assert(v && rope);
+
+   uint64_t u;
+   if (unlikely(!chck_rope_read_varint(&u, rope)))
+      return false;
+
+   *v = zigzag_decode(u);
+   return true;
+}
+
+size_t
+chck_rope_read_varints(uint64_t *dst, size_t memb, struct chck_rope *rope)
+{
+   assert(dst && rope);
+
+   // varints within segment go through batched decoder of chck_buffer view, one spanning segments alone
+   size_t n = 0;
+   while (n < memb) {
+      size_t avail;
+      const uint8_t *p = contiguous(rope, &avail);
+
+      struct chck_buffer view;
+      chck_buffer_from_pointer(&view, (void*)p, avail, CHCK_ENDIANESS_NATIVE);
+      const size_t k = (avail > 0 ? chck_buffer_read_varints(dst + n, memb - n, &view) : 0);
+      advance(rope, NULL, view.curpos - view.buffer);
+      n += k;
+
+      if (n < memb) {
+         if (!chck_rope_read_varint(&dst[n], rope))
+            break;
+
+         ++n;
+      }
+   }
+
+   return n;
+}
+
+ptrdiff_t
+chck_rope_seek(struct chck_rope *rope, long offset, int whence)
+{
+   assert(rope);
+   assert(whence == SEEK_SET || whence == SEEK_END || whence == SEEK_CUR);
+
+   size_t target = 0;
+   switch (whence) {
+      case SEEK_SET:
+         target = (offset > 0 ? (size_t)offset : 0);
+         break;
+      case SEEK_CUR:
+         target = (offset < 0 && (size_t)-offset > rope->position ? 0 : rope->position + offset);
+         break;
+      case SEEK_END:
+         target = rope->size;
+         break;
+      default:break;
+   }
+
+   if (target > rope->size)
+      target = rope->size;
+
+   rope->position = rope->segment = rope->offset = 0;
+
+   if (rope->count > 0)
+      advance(rope, NULL, target);
+
+   return rope->position;
+}
+
+size_t
+chck_rope_write_to_fd(int fd, struct chck_rope *rope)
+{
+   assert(fd >= 0 && rope);
+
+   size_t wrote = 0;
+   while (rope->position < rope->size) {
+      // every segment after read position, in one writev
+      size_t n = 0;
+      struct iovec iov[IOVS];
+      for (size_t i = rope->segment, off = rope->offset; i < rope->count && n < IOVS; ++i, off = 0) {
+         if (rope->segments[i].size > off)
+            iov[n++] = (struct iovec){ .iov_base = rope->segments[i].data + off, .iov_len = rope->segments[i].size - off };
+      }
+
+      size_t ret;
+      if (!(ret = writev_some(fd, iov, n)))
+         break;
+
+      wrote += ret;
+      advance(rope, NULL, ret);
+   }
+
+   return wrote;
+}
+
+const void*
+chck_rope_flatten(struct chck_rope *rope)
+{
+   assert(rope);
+
+   if (!rope->size)
+      return NULL;
+
+   if (rope->count == 1 && rope->segments[0].owned)
+      return rope->segments[0].data;
+
+   uint8_t *data;
+   if (!(data = malloc(rope->size)))
+      return NULL;
+
+   size_t off = 0;
+   for (size_t i = 0; i < rope->count; ++i) {
+      memcpy(data + off, rope->segments[i].data, rope->segments[i].size);
+      off += rope->segments[i].size;
+
+      if (rope->segments[i].owned)
+         free(rope->segments[i].data);
+   }
+
+   // read position stays the same
+   rope->segments[0] = (struct chck_rope_segment){ .data = data, .size = rope->size, .capacity = rope->size, .owned = true };
+   rope->count = 1;
+   rope->segment = 0;
+   rope->offset = rope->position;
+   return data;
+}
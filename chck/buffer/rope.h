@@ -0,0 +1,70 @@
+#ifndef __chck_rope__
+#define __chck_rope__
+
+#include "buffer.h"
+
+struct chck_rope_segment {
+   uint8_t *data;
+
+   // size of data, and allocated size for owned segments that can still be appended to
+   size_t size, capacity;
+
+   // owned == true, means that data is owned by the rope and will be freed on chck_rope_release
+   bool owned;
+};
+
+struct chck_rope {
+   struct chck_rope_segment *segments;
+   size_t count, allocated;
+
+   // read position, and the segment and offset within it
+   size_t position, segment, offset;
+
+   // size of all segments
+   size_t size;
+
+   // endianess true == big, false == little
+   bool endianess;
+};
+
+bool chck_rope(struct chck_rope *rope, enum chck_endianess endianess);
+void chck_rope_release(struct chck_rope *rope);
+
+/* copies into owned segment, small writes are packed to same segment */
+size_t chck_rope_write(const void *src, size_t size, size_t memb, struct chck_rope *rope);
+/* references src without copying, src must stay valid until rope is released or flattened */
+bool chck_rope_write_ref(const void *src, size_t size, struct chck_rope *rope);
+bool chck_rope_write_int(const void *i, enum chck_bits bits, struct chck_rope *rope);
+size_t chck_rope_write_ints(const void *src, enum chck_bits bits, size_t memb, struct chck_rope *rope);
+bool chck_rope_write_string(const char *str, size_t len, struct chck_rope *rope);
+bool chck_rope_write_string_of_type(const char *str, size_t len, enum chck_bits bits, struct chck_rope *rope);
+bool chck_rope_write_varint(uint64_t v, struct chck_rope *rope);
+bool chck_rope_write_varint_signed(int64_t v, struct chck_rope *rope);
+size_t chck_rope_write_varints(const uint64_t *src, size_t memb, struct chck_rope *rope);
+
+/* reads mirror chck_buffer_read*, values may span segments */
+size_t chck_rope_read(void *dst, size_t size, size_t memb, struct chck_rope *rope);
+bool chck_rope_read_int(void *i, enum chck_bits bits, struct chck_rope *rope);
+size_t chck_rope_read_ints(void *dst, enum chck_bits bits, size_t memb, struct chck_rope *rope);
+bool chck_rope_read_string(char **str, size_t *len, struct chck_rope *rope);
+bool chck_rope_read_string_of_type(char **str, size_t *len, enum chck_bits bits, struct chck_rope *rope);
+bool chck_rope_read_varint(uint64_t *v, struct chck_rope *rope);
+bool chck_rope_read_varint_signed(int64_t *v, struct chck_rope *rope);
+size_t chck_rope_read_varints(uint64_t *dst, size_t memb, struct chck_rope *rope);
+
+/* views point into a segment without copying, they fail and leave position untouched when the bytes span segments,
+ * after chck_rope_flatten every view succeeds. valid until rope is released or flattened. */
+bool chck_rope_read_bytes_view(const void **data, size_t len, struct chck_rope *rope);
+bool chck_rope_read_string_view(const char **str, size_t *len, struct chck_rope *rope);
+bool chck_rope_read_string_view_of_type(const char **str, size_t *len, enum chck_bits bits, struct chck_rope *rope);
+
+ptrdiff_t chck_rope_seek(struct chck_rope *rope, long offset, int whence);
+
+/* writes everything after read position with writev, and advances it, returns bytes written.
+ * loops until done, or EAGAIN on non-blocking fd */
+size_t chck_rope_write_to_fd(int fd, struct chck_rope *rope);
+
+/* copies segments to single owned segment, returns pointer to it or NULL on failure (or empty rope) */
+const void* chck_rope_flatten(struct chck_rope *rope);
+
+#endif /* __chck_rope__ */
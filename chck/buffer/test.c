@@ -1,12 +1,54 @@
 #include "buffer.h"
+#include "rope.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 #undef NDEBUG
 #include <assert.h>
 
+#ifndef HAS_ZLIB
+#  define HAS_ZLIB 0
+#endif
+
+#ifndef HAS_LZ4
+#  define HAS_LZ4 0
+#endif
+
+#ifndef HAS_ZSTD
+#  define HAS_ZSTD 0
+#endif
+
+static double
+elapsed(const struct timespec *start)
+{
+   struct timespec end;
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static size_t
+fill_records(uint8_t *data, size_t size)
+{
+   // cache/network like payload, repetitive keys with varying values
+   size_t len = 0;
+   for (uint32_t i = 0; len < size; ++i) {
+      char line[128];
+      const int n = snprintf(line, sizeof(line), "{\"id\":%u,\"user\":\"user%u\",\"score\":%u,\"active\":%s}\n", i, (i * 7919) % 1000, (i * 2654435761u) >> 20, (i % 3 ? "true" : "false"));
+      const size_t copy = ((size_t)n < size - len ? (size_t)n : size - len);
+      memcpy(data + len, line, copy);
+      len += copy;
+   }
+   return len;
+}
+
 int main(void)
 {
    /* TEST: ownership move */
@@ -46,6 +88,84 @@ int main(void)
 
    }
 
+   /* TEST: formatting in place and fast text writers */
+   {
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+
+      // truncated format grows and retries, spare capacity is used as is
+      assert(chck_buffer_write_format(&buf, "%s %d", "first", 1) == 7);
+      assert(buf.size == 7 && buf.capacity >= 8);
+      assert(chck_buffer_reserve(&buf, 64));
+      const uint8_t *reserved = buf.buffer;
+      assert(chck_buffer_write_format(&buf, ", %s %d", "second", 2) == 10);
+      assert(buf.buffer == reserved && buf.size == 17);
+      assert(!memcmp(buf.buffer, "first 1, second 2", 17));
+
+      // overwriting in the middle keeps the rest
+      chck_buffer_seek(&buf, 0, SEEK_SET);
+      assert(chck_buffer_write_format(&buf, "%s", "FIRST") == 5);
+      assert(buf.size == 17 && !memcmp(buf.buffer, "FIRST 1, second 2", 17));
+      chck_buffer_release(&buf);
+
+      const uint64_t u[] = { 0, 9, 10, 99, 100, 12345, 1000000007, UINT64_MAX };
+      const int64_t i[] = { 0, -1, 42, -1000, INT64_MAX, INT64_MIN };
+      const double d[] = { 0.0, -0.0, 1.5, -2.25, 3.14159, 0.001, 123456.789, -0.004, 1e20, 1e300 / 1e-10 * 1e-300 };
+      const uint8_t precision[] = { 0, 1, 2, 3, 6, 12 };
+
+      char expected[2048], *e = expected;
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+      for (size_t k = 0; k < sizeof(u) / sizeof(u[0]); ++k) {
+         assert(chck_buffer_write_u64_dec(u[k], &buf) > 0);
+         assert(chck_buffer_write_u64_hex(u[k], &buf) > 0);
+         e += sprintf(e, "%" PRIu64 "%" PRIx64, u[k], u[k]);
+      }
+
+      for (size_t k = 0; k < sizeof(i) / sizeof(i[0]); ++k) {
+         assert(chck_buffer_write_i64_dec(i[k], &buf) > 0);
+         e += sprintf(e, "%" PRId64, i[k]);
+      }
+
+      for (size_t k = 0; k < sizeof(d) / sizeof(d[0]); ++k) {
+         for (size_t p = 0; p < sizeof(precision) / sizeof(precision[0]); ++p) {
+            assert(chck_buffer_write_double(d[k], precision[p], &buf) > 0);
+            e += sprintf(e, "%.*f", precision[p], d[k]);
+         }
+      }
+
+      assert(buf.size == (size_t)(e - expected) && !memcmp(buf.buffer, expected, buf.size));
+      chck_buffer_release(&buf);
+
+      // ties, values whose scaling rounds across half, subnormals, and both sides of printf fallback
+      const double edge[] = {
+         0.5, 2.5, 0.125, 0.375, 1.005, 2.675, 1.0000000005, 0.045, 4.35, 1e-9, 5e-10, 4.9999999999999995e-10,
+         5e-324, 2.2250738585072009e-308, 2.2250738585072014e-308, 4503599627370495.5, 4503599627370496.5,
+         9007199254740993.0, 1e22, 1.7976931348623157e308,
+      };
+
+      // and a spread of random bit patterns, from tiny to large exponents
+      uint64_t seed = 0x9e3779b97f4a7c15;
+      for (size_t k = 0; k < sizeof(edge) / sizeof(edge[0]) + 20000; ++k) {
+         double v;
+         if (k < sizeof(edge) / sizeof(edge[0])) {
+            v = edge[k];
+         } else {
+            seed = seed * 6364136223846793005 + 1442695040888963407;
+            uint64_t bits = (seed >> 11) | ((uint64_t)(990 + (seed >> 59) * 4 + k % 4) << 52);
+            memcpy(&v, &bits, sizeof(v));
+         }
+
+         for (uint8_t p = 0; p < 12; ++p) {
+            char want[512];
+            const int len = snprintf(want, sizeof(want), "%.*f", p, -v);
+            assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+            assert(chck_buffer_write_double(-v, p, &buf) == (size_t)len);
+            assert(!memcmp(buf.buffer, want, len));
+            chck_buffer_release(&buf);
+         }
+      }
+   }
+
    /* TEST: little endian buffer */
    {
       const struct {
@@ -131,6 +251,221 @@ int main(void)
       }
    }
 
+   /* TEST: geometric growth and reserve */
+   {
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+      assert(buf.size == 0 && buf.capacity == 0);
+
+      // size follows the written data, capacity grows ahead of it
+      size_t reallocs = 0, capacity = 0;
+      for (uint32_t i = 0; i < 100000; ++i) {
+         assert(chck_buffer_write_int(&i, sizeof(i), &buf));
+         assert(buf.size == (i + 1) * sizeof(i) && buf.capacity >= buf.size);
+         reallocs += (capacity != buf.capacity);
+         capacity = buf.capacity;
+      }
+
+      assert(reallocs < 32);
+      chck_buffer_seek(&buf, 0, SEEK_SET);
+      for (uint32_t t, i = 0; i < 100000; ++i)
+         assert(chck_buffer_read_int(&t, sizeof(t), &buf) && t == i);
+      chck_buffer_release(&buf);
+
+      // growth is linear after max_step
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+      buf.max_step = 1024;
+      assert(chck_buffer_reserve(&buf, 4096) && buf.capacity == 4096 && buf.size == 0);
+      const uint8_t *reserved = buf.buffer;
+      for (size_t i = 0; i < 4096; ++i)
+         assert(chck_buffer_write("x", 1, 1, &buf) == 1);
+      assert(buf.buffer == reserved);
+      assert(chck_buffer_write("x", 1, 1, &buf) == 1);
+      assert(buf.capacity == 4096 + 1024 && buf.size == 4097);
+      assert(chck_buffer_reserve(&buf, 16) && buf.capacity == 4096 + 1024);
+      assert(chck_buffer_resize(&buf, 8) && buf.capacity == 8 && buf.curpos == buf.buffer + 8);
+
+      // flushed buffer is empty, and grows again from nothing
+      for (int f = 0; f < 2; ++f) {
+         if (f) {
+            chck_buffer_flush(&buf);
+         } else {
+            assert(chck_buffer_resize(&buf, 0));
+         }
+         assert(buf.size == 0 && buf.capacity == 0 && !buf.buffer);
+         assert(chck_buffer_write("abc", 1, 3, &buf) == 3);
+         assert(buf.size == 3 && buf.capacity >= buf.size);
+         char abc[4] = {0};
+         chck_buffer_seek(&buf, 0, SEEK_SET);
+         assert(chck_buffer_read(abc, 1, 4, &buf) == 3 && !strcmp(abc, "abc"));
+      }
+      chck_buffer_release(&buf);
+
+      // buffer that is not owned is copied on growth
+      char data[] = "not ours";
+      assert(chck_buffer_from_pointer(&buf, data, sizeof(data) - 1, CHCK_ENDIANESS_NATIVE));
+      chck_buffer_seek(&buf, 0, SEEK_END);
+      assert(chck_buffer_write("!", 1, 1, &buf) == 1);
+      assert(buf.copied && !memcmp(buf.buffer, "not ours!", 9) && !strcmp(data, "not ours"));
+      chck_buffer_release(&buf);
+   }
+
+   /* TEST: string and bytes views */
+   {
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, 1, !chck_endianess()));
+      assert(chck_buffer_write_string("hello", 5, &buf));
+      assert(chck_buffer_write_string_of_type("view", 4, CHCK_BUFFER_B32, &buf));
+      assert(chck_buffer_write_string("", 0, &buf));
+      assert(chck_buffer_write("\1\2\3", 1, 3, &buf) == 3);
+      assert(chck_buffer_write_string_of_type("short", 6, CHCK_BUFFER_B16, &buf));
+      assert(chck_buffer_resize(&buf, buf.curpos - buf.buffer - 1));
+      chck_buffer_seek(&buf, 0, SEEK_SET);
+
+      // point straight into the buffer
+      size_t len;
+      const char *str;
+      assert(chck_buffer_read_string_view(&str, &len, &buf));
+      assert(len == 5 && !memcmp(str, "hello", 5));
+      assert((uint8_t*)str > buf.buffer && (uint8_t*)str < buf.curpos);
+      assert(chck_buffer_read_string_view_of_type(&str, &len, CHCK_BUFFER_B32, &buf));
+      assert(len == 4 && !memcmp(str, "view", 4));
+      assert(chck_buffer_read_string_view(&str, &len, &buf));
+      assert(len == 0 && !str);
+
+      const void *bytes;
+      assert(chck_buffer_read_bytes_view(&bytes, 3, &buf));
+      assert(!memcmp(bytes, "\1\2\3", 3));
+
+      // short string is not returned
+      assert(!chck_buffer_read_string_view_of_type(&str, &len, CHCK_BUFFER_B16, &buf));
+      assert(!str && len == 0);
+
+      const uint8_t *pos = buf.curpos;
+      assert(!chck_buffer_read_bytes_view(&bytes, 6, &buf));
+      assert(!bytes && buf.curpos == pos);
+      assert(chck_buffer_read_bytes_view(&bytes, 5, &buf));
+      assert(!memcmp(bytes, "short", 5));
+      chck_buffer_release(&buf);
+   }
+
+   /* TEST: bulk integer read/write */
+   {
+      // odd counts leave tail for the scalar path after simd
+      const size_t counts[] = { 0, 1, 7, 31, 33, 1000 };
+      const enum chck_bits bits[] = { CHCK_BUFFER_B8, CHCK_BUFFER_B16, CHCK_BUFFER_B32, CHCK_BUFFER_B64 };
+      enum chck_endianess tests[] = { CHCK_ENDIANESS_NATIVE, !chck_endianess() };
+      for (int t = 0; t < 2; ++t) {
+         for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            for (size_t b = 0; b < sizeof(bits) / sizeof(bits[0]); ++b) {
+               uint8_t src[1000 * sizeof(uint64_t)], dst[sizeof(src)];
+               for (size_t i = 0; i < sizeof(src); ++i)
+                  src[i] = i * 7;
+
+               struct chck_buffer buf;
+               assert(chck_buffer(&buf, 1, tests[t]));
+               assert(chck_buffer_write_ints(src, bits[b], counts[c], &buf) == counts[c]);
+               assert(buf.curpos - buf.buffer == (ptrdiff_t)(bits[b] * counts[c]));
+
+               // same bytes as writing one at a time
+               for (size_t i = 0; i < counts[c]; ++i) {
+                  uint8_t e[sizeof(uint64_t)];
+                  memcpy(e, src + i * bits[b], bits[b]);
+                  if (!chck_buffer_native_endianess(&buf))
+                     chck_bswap_single(e, bits[b]);
+                  assert(!memcmp(buf.buffer + i * bits[b], e, bits[b]));
+               }
+
+               // reads only what is there
+               struct chck_buffer rbuf;
+               assert(chck_buffer_from_pointer(&rbuf, buf.buffer, buf.curpos - buf.buffer, tests[t]));
+               assert(chck_buffer_read_ints(dst, bits[b], counts[c] + 1, &rbuf) == counts[c]);
+               assert(!memcmp(src, dst, bits[b] * counts[c]));
+               chck_buffer_release(&rbuf);
+               chck_buffer_release(&buf);
+            }
+         }
+      }
+
+      uint32_t v = 1;
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, 1, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_write_ints(&v, 3, 1, &buf) == 0);
+      assert(chck_buffer_read_ints(&v, 3, 1, &buf) == 0);
+      chck_buffer_release(&buf);
+   }
+
+   /* TEST: varints */
+   {
+      const uint64_t values[] = {
+         0, 1, 127, 128, 300, 16383, 16384, UINT32_MAX,
+         (UINT64_C(1) << 56) - 1, UINT64_C(1) << 56, UINT64_C(1) << 63, UINT64_MAX
+      };
+      const size_t sizes[] = { 1, 1, 1, 2, 2, 2, 3, 5, 8, 9, 10, 10 };
+      const int64_t signs[] = { 0, -1, 1, -64, 64, INT64_MIN, INT64_MAX };
+
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, 1, CHCK_ENDIANESS_NATIVE));
+      for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+         const ptrdiff_t pos = buf.curpos - buf.buffer;
+         assert(chck_buffer_write_varint(values[i], &buf));
+         assert(buf.curpos - buf.buffer - pos == (ptrdiff_t)sizes[i]);
+      }
+
+      assert(!memcmp(buf.buffer, "\x0\x1\x7f\x80\x1\xac\x2", 7));
+
+      for (size_t i = 0; i < sizeof(signs) / sizeof(signs[0]); ++i)
+         assert(chck_buffer_write_varint_signed(signs[i], &buf));
+
+      // -1 and 1 zigzag to single bytes
+      struct chck_buffer rbuf;
+      assert(chck_buffer_from_pointer(&rbuf, buf.buffer, buf.curpos - buf.buffer, CHCK_ENDIANESS_BIG));
+      for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+         uint64_t v;
+         assert(chck_buffer_read_varint(&v, &rbuf) && v == values[i]);
+      }
+
+      assert(!memcmp(rbuf.curpos, "\x0\x1\x2", 3));
+      for (size_t i = 0; i < sizeof(signs) / sizeof(signs[0]); ++i) {
+         int64_t v;
+         assert(chck_buffer_read_varint_signed(&v, &rbuf) && v == signs[i]);
+      }
+
+      // truncated and overlong varints are not read
+      uint64_t v;
+      assert(!chck_buffer_read_varint(&v, &rbuf));
+      assert(chck_buffer_from_pointer(&rbuf, "\x80\x80", 2, CHCK_ENDIANESS_NATIVE));
+      assert(!chck_buffer_read_varint(&v, &rbuf) && rbuf.curpos == rbuf.buffer);
+      assert(chck_buffer_from_pointer(&rbuf, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x1", 11, CHCK_ENDIANESS_NATIVE));
+      assert(!chck_buffer_read_varint(&v, &rbuf));
+
+      // 10th byte with more than the 64th bit overflows
+      assert(chck_buffer_from_pointer(&rbuf, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x2", 10, CHCK_ENDIANESS_NATIVE));
+      assert(!chck_buffer_read_varint(&v, &rbuf) && rbuf.curpos == rbuf.buffer);
+      assert(!chck_buffer_read_varints(&v, 1, &rbuf) && rbuf.curpos == rbuf.buffer);
+      assert(chck_buffer_from_pointer(&rbuf, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x1", 10, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_read_varint(&v, &rbuf) && v == UINT64_MAX);
+      chck_buffer_release(&buf);
+
+      // batched decoder matches single reads, on runs of small values, mixed short lengths and mixed lengths
+      uint64_t src[1000], dst[1001];
+      for (size_t i = 0; i < 1000; ++i)
+         src[i] = (i < 200 ? i % 100 : (i < 600 ? (UINT64_C(1) << (i * 5 % 28)) + i : values[(i * 7) % (sizeof(values) / sizeof(values[0]))] >> (i % 13)));
+
+      assert(chck_buffer(&buf, 1, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_write_varints(src, 1000, &buf) == 1000);
+      assert(chck_buffer_write("\x80", 1, 1, &buf) == 1);
+      assert(chck_buffer_from_pointer(&rbuf, buf.buffer, buf.curpos - buf.buffer, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_read_varints(dst, 1001, &rbuf) == 1000);
+      assert(!memcmp(src, dst, sizeof(src)));
+      assert(rbuf.curpos == buf.curpos - 1);
+
+      chck_buffer_seek(&rbuf, 0, SEEK_SET);
+      for (size_t i = 0; i < 1000; ++i)
+         assert(chck_buffer_read_varint(&v, &rbuf) && v == src[i]);
+      chck_buffer_release(&buf);
+   }
+
    /* TEST: zlib compression && decompression */
    {
       char uncompressed[] = ".....................";
@@ -154,6 +489,419 @@ int main(void)
       chck_buffer_release(&buf);
    }
 
+   /* TEST: streaming zlib */
+   {
+      const size_t size = 4 * 1024 * 1024;
+      uint8_t *data;
+      assert((data = malloc(size)));
+      for (size_t i = 0; i < size; ++i)
+         data[i] = (i % 4096 < 3000 ? 'a' + i % 7 : (i * 2654435761u) >> 24);
+
+#if HAS_ZLIB
+      // compress and decompress in uneven chunks
+      struct chck_buffer_zstream stream;
+      struct chck_buffer compressed, decompressed;
+      assert(chck_buffer(&compressed, 0, CHCK_ENDIANESS_NATIVE) && chck_buffer(&decompressed, 0, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_zstream(&stream, true, -1));
+      for (size_t off = 0, chunk = 1; off < size; off += chunk, chunk = chunk * 3 + 1) {
+         if (off + chunk > size)
+            chunk = size - off;
+         assert(chck_buffer_zstream_write(&stream, data + off, chunk, false, &compressed));
+      }
+      assert(chck_buffer_zstream_write(&stream, NULL, 0, true, &compressed));
+      chck_buffer_zstream_release(&stream);
+      assert(compressed.size > 0 && compressed.size < size);
+
+      assert(chck_buffer_zstream(&stream, false, -1));
+      for (size_t off = 0; off < compressed.size; off += 1000)
+         assert(chck_buffer_zstream_write(&stream, compressed.buffer + off, (compressed.size - off < 1000 ? compressed.size - off : 1000), false, &decompressed));
+      assert(stream.end && chck_buffer_zstream_write(&stream, NULL, 0, true, &decompressed));
+      chck_buffer_zstream_release(&stream);
+      assert(decompressed.size == size && !memcmp(decompressed.buffer, data, size));
+
+      // truncated stream does not finish
+      chck_buffer_seek(&decompressed, 0, SEEK_SET);
+      assert(chck_buffer_zstream(&stream, false, -1));
+      assert(!chck_buffer_zstream_write(&stream, compressed.buffer, compressed.size / 2, true, &decompressed));
+      chck_buffer_zstream_release(&stream);
+
+      // through fds, compressed to file and inflated back from it
+      FILE *f;
+      assert((f = tmpfile()));
+      assert(chck_buffer_zstream(&stream, true, 9));
+      assert(chck_buffer_zstream_write_to_fd(&stream, data, size / 2, false, fileno(f)));
+      assert(chck_buffer_zstream_write_to_fd(&stream, data + size / 2, size - size / 2, true, fileno(f)));
+      chck_buffer_zstream_release(&stream);
+
+      assert(lseek(fileno(f), 0, SEEK_SET) == 0);
+      chck_buffer_seek(&decompressed, 0, SEEK_SET);
+      assert(chck_buffer_zstream(&stream, false, -1));
+      assert(chck_buffer_zstream_write_from_fd(&stream, fileno(f), true, &decompressed));
+      chck_buffer_zstream_release(&stream);
+      assert(decompressed.size == size && !memcmp(decompressed.buffer, data, size));
+      fclose(f);
+
+      // one-shot decompression of high ratio input
+      memset(data, 0, size);
+      chck_buffer_release(&compressed);
+      assert(chck_buffer_from_pointer(&compressed, data, size, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_compress_zlib(&compressed) && compressed.size < size / 100);
+      assert(chck_buffer_decompress_zlib(&compressed));
+      assert(compressed.size == size && compressed.capacity == size && !memcmp(compressed.buffer, data, size));
+      chck_buffer_release(&compressed);
+      chck_buffer_release(&decompressed);
+#else
+      struct chck_buffer_zstream stream;
+      assert(!chck_buffer_zstream(&stream, true, -1));
+      chck_buffer_zstream_release(&stream);
+#endif
+      free(data);
+   }
+
+   /* TEST: mmap file */
+   {
+      char path[] = "/tmp/chck-buffer-XXXXXX";
+      int fd;
+      assert((fd = mkstemp(path)) >= 0);
+
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_BIG));
+      assert(chck_buffer_write_string("mapped", 6, &buf));
+      for (uint32_t i = 0; i < 100000; ++i)
+         assert(chck_buffer_write_int(&i, sizeof(i), &buf));
+      assert(write(fd, buf.buffer, buf.size) == (ssize_t)buf.size);
+      const size_t size = buf.size;
+      chck_buffer_release(&buf);
+
+      const uint32_t flags[] = { 0, CHCK_BUFFER_MMAP_POPULATE | CHCK_BUFFER_MMAP_SEQUENTIAL, CHCK_BUFFER_MMAP_WILLNEED };
+      for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+         assert(chck_buffer_from_file_mmap_with_flags(&buf, path, CHCK_ENDIANESS_BIG, flags[f]));
+         assert(buf.mapped && !buf.copied && buf.size == size);
+
+         // read apis work on the mapping, views point into it
+         size_t len;
+         const char *str;
+         assert(chck_buffer_read_string_view(&str, &len, &buf));
+         assert(len == 6 && !memcmp(str, "mapped", 6));
+         for (uint32_t t, i = 0; i < 100000; ++i)
+            assert(chck_buffer_read_int(&t, sizeof(t), &buf) && t == i);
+         chck_buffer_release(&buf);
+      }
+
+      // first write copies the mapping, file stays as is
+      assert(chck_buffer_from_file_mmap(&buf, path, CHCK_ENDIANESS_BIG));
+      chck_buffer_seek(&buf, 2, SEEK_SET);
+      assert(chck_buffer_write("MAPPED", 1, 6, &buf) == 6);
+      assert(!buf.mapped && buf.copied && buf.size == size);
+      assert(!memcmp(buf.buffer, "\x1\x6MAPPED", 8));
+      chck_buffer_release(&buf);
+
+      assert(chck_buffer_from_file_mmap(&buf, path, CHCK_ENDIANESS_BIG));
+      assert(!memcmp(buf.buffer, "\x1\x6mapped", 8));
+      chck_buffer_release(&buf);
+
+      // empty file is empty buffer
+      assert(ftruncate(fd, 0) == 0);
+      assert(chck_buffer_from_file_mmap(&buf, path, CHCK_ENDIANESS_BIG));
+      assert(!buf.mapped && !buf.buffer && !buf.size);
+      assert(chck_buffer_write("x", 1, 1, &buf) == 1);
+      chck_buffer_release(&buf);
+
+      close(fd);
+      unlink(path);
+      assert(!chck_buffer_from_file_mmap(&buf, path, CHCK_ENDIANESS_BIG));
+   }
+
+   /* TEST: looped fd io */
+   {
+      int fds[2];
+      assert(pipe(fds) == 0);
+
+      // writer sends in pieces, fill continues short reads until it has everything
+      pid_t pid;
+      assert((pid = fork()) >= 0);
+      if (!pid) {
+         for (int i = 0; i < 3; ++i) {
+            usleep(10000);
+            assert(write(fds[1], "0123456789", 10) == 10);
+         }
+         _exit(EXIT_SUCCESS);
+      }
+
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_write_from_fd(fds[0], 10, 3, &buf) == 3);
+      assert(buf.size == 30 && !memcmp(buf.buffer + 20, "0123456789", 10));
+      waitpid(pid, NULL, 0);
+
+      // non-blocking fd returns what there is
+      assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+      assert(write(fds[1], "abcde", 5) == 5);
+      chck_buffer_seek(&buf, 0, SEEK_SET);
+      assert(chck_buffer_fill_from_fd(fds[0], 1, 100, &buf) == 5 && errno == EAGAIN);
+      assert(!memcmp(buf.buffer, "abcde", 5));
+      chck_buffer_release(&buf);
+
+      // elements are not split when non-blocking fd runs out in middle of one
+      assert((pid = fork()) >= 0);
+      if (!pid) {
+         assert(write(fds[1], "012345", 6) == 6);
+         usleep(10000);
+         assert(write(fds[1], "67", 2) == 2);
+         _exit(EXIT_SUCCESS);
+      }
+
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+      usleep(1000);
+      assert(chck_buffer_write_from_fd(fds[0], 4, 3, &buf) == 2 && errno == EAGAIN);
+      assert(buf.size == 8 && buf.curpos == buf.buffer + 8 && !memcmp(buf.buffer, "01234567", 8));
+      waitpid(pid, NULL, 0);
+      chck_buffer_release(&buf);
+
+      // scatter output of many buffers, continued after EAGAIN
+      assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+      struct chck_buffer bufs[3];
+      const size_t sizes[] = { 100000, 7, 300000 };
+      for (size_t i = 0; i < 3; ++i) {
+         assert(chck_buffer(&bufs[i], sizes[i], CHCK_ENDIANESS_NATIVE));
+         memset(bufs[i].buffer, 'a' + i, sizes[i]);
+      }
+
+      size_t wrote = 0, got = 0;
+      assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+      while (got < 400007) {
+         wrote += chck_buffer_write_to_fd(fds[1], bufs, 3);
+         got += chck_buffer_write_from_fd(fds[0], 1, 400007 - got, &buf);
+      }
+
+      assert(wrote == 400007 && buf.size == 400007);
+      assert(buf.buffer[99999] == 'a' && buf.buffer[100000] == 'b' && buf.buffer[100006] == 'b' && buf.buffer[100007] == 'c');
+      for (size_t i = 0; i < 3; ++i) {
+         assert(bufs[i].curpos == bufs[i].buffer + sizes[i]);
+         chck_buffer_release(&bufs[i]);
+      }
+      assert(chck_buffer_write_to_fd(fds[1], bufs, 0) == 0);
+
+      // partial element at end of file is dropped
+      struct chck_buffer part;
+      assert(chck_buffer(&part, 0, CHCK_ENDIANESS_NATIVE));
+      assert(write(fds[1], "0123456", 7) == 7);
+      close(fds[1]);
+      assert(chck_buffer_write_from_fd(fds[0], 4, 3, &part) == 1);
+      assert(part.size == 4 && part.curpos == part.buffer + 4);
+      chck_buffer_release(&part);
+      close(fds[0]);
+
+      // file to file, file to pipe and pipe to file without user-space copies
+      FILE *a, *b;
+      assert((a = tmpfile()) && (b = tmpfile()));
+      assert(write(fileno(a), buf.buffer, buf.size) == (ssize_t)buf.size);
+      assert(lseek(fileno(a), 0, SEEK_SET) == 0);
+      assert(chck_buffer_copy_fd(fileno(b), fileno(a), buf.size + 1) == buf.size);
+
+      assert(pipe(fds) == 0);
+      assert(lseek(fileno(b), 0, SEEK_SET) == 0);
+      assert(chck_buffer_copy_fd(fds[1], fileno(b), 1000) == 1000);
+      close(fds[1]);
+      assert(ftruncate(fileno(a), 0) == 0 && lseek(fileno(a), 0, SEEK_SET) == 0);
+      assert(chck_buffer_copy_fd(fileno(a), fds[0], 2000) == 1000);
+      close(fds[0]);
+
+      struct chck_buffer copy;
+      assert(chck_buffer(&copy, 0, CHCK_ENDIANESS_NATIVE));
+      assert(lseek(fileno(a), 0, SEEK_SET) == 0);
+      assert(chck_buffer_write_from_fd(fileno(a), 1, 2000, &copy) == 1000);
+      assert(!memcmp(copy.buffer, buf.buffer, 1000));
+      chck_buffer_release(&copy);
+      chck_buffer_release(&buf);
+      fclose(a);
+      fclose(b);
+   }
+
+   /* TEST: rope */
+   {
+      struct chck_rope rope;
+      assert(chck_rope(&rope, CHCK_ENDIANESS_BIG));
+
+      // small writes pack to one owned segment, references split it
+      const char header[] = "header", body[] = "body";
+      assert(chck_rope_write(header, 1, 6, &rope) == 6);
+      assert(chck_rope_write_int((uint16_t[]){0x1234}, CHCK_BUFFER_B16, &rope));
+      assert(chck_rope_write_ref(body, 4, &rope));
+      assert(chck_rope_write_ref(body, 0, &rope));
+      assert(chck_rope_write_int((uint32_t[]){0xdeadbeef}, CHCK_BUFFER_B32, &rope));
+      assert(chck_rope_write_string("hello", 5, &rope));
+      assert(rope.count == 3 && rope.size == 6 + 2 + 4 + 4 + 1 + 1 + 5);
+
+      // varint split across referenced segments
+      const uint8_t v0[] = { 0xac }, v1[] = { 0x02 };
+      assert(chck_rope_write_ref(v0, 1, &rope));
+      assert(chck_rope_write_ref(v1, 1, &rope));
+
+      char tmp[6];
+      assert(chck_rope_read(tmp, 1, 6, &rope) == 6 && !memcmp(tmp, header, 6));
+      uint16_t u16;
+      assert(chck_rope_read_int(&u16, CHCK_BUFFER_B16, &rope) && u16 == 0x1234);
+
+      // int spanning referenced and owned segment
+      chck_rope_seek(&rope, 10, SEEK_SET);
+      uint32_t u32;
+      assert(chck_rope_read_int(&u32, CHCK_BUFFER_B32, &rope) && u32 == 0x6479dead);
+      assert(chck_rope_read_int(&u32, CHCK_BUFFER_B32, &rope) && u32 == 0xbeef0105);
+
+      chck_rope_seek(&rope, 12, SEEK_SET);
+      assert(chck_rope_read_int(&u32, CHCK_BUFFER_B32, &rope) && u32 == 0xdeadbeef);
+      char *str;
+      size_t len;
+      assert(chck_rope_read_string(&str, &len, &rope) && len == 5 && !memcmp(str, "hello", 5));
+      free(str);
+
+      uint64_t v;
+      assert(chck_rope_read_varint(&v, &rope) && v == 300);
+      assert(!chck_rope_read_varint(&v, &rope) && !chck_rope_read_int(&u16, CHCK_BUFFER_B16, &rope));
+      assert(chck_rope_seek(&rope, -2, SEEK_CUR) == (ptrdiff_t)rope.size - 2);
+
+      // truncated varint leaves position untouched
+      const uint8_t v2[] = { 0x80 };
+      assert(chck_rope_write_ref(v2, 1, &rope));
+      assert(chck_rope_seek(&rope, -1, SEEK_END) == (ptrdiff_t)rope.size);
+      chck_rope_seek(&rope, rope.size - 1, SEEK_SET);
+      assert(!chck_rope_read_varint(&v, &rope) && rope.position == rope.size - 1);
+
+      // writev everything from read position
+      FILE *f;
+      assert((f = tmpfile()));
+      chck_rope_seek(&rope, 6, SEEK_SET);
+      assert(chck_rope_write_to_fd(fileno(f), &rope) == rope.size - 6);
+      assert(rope.position == rope.size && chck_rope_write_to_fd(fileno(f), &rope) == 0);
+
+      // appending to owned tail after reading to the end is still visible
+      assert(chck_rope_write(header, 1, 6, &rope) == 6);
+      assert(chck_rope_write_to_fd(fileno(f), &rope) == 6);
+
+      uint8_t out[64];
+      assert(lseek(fileno(f), 0, SEEK_SET) == 0);
+      assert(read(fileno(f), out, sizeof(out)) == (ssize_t)rope.size - 6);
+      fclose(f);
+
+      // flatten keeps contents and read position
+      chck_rope_seek(&rope, 6, SEEK_SET);
+      const uint8_t *flat;
+      assert((flat = chck_rope_flatten(&rope)) && rope.count == 1);
+      assert(!memcmp(flat, header, 6) && !memcmp(flat + 6, out, rope.size - 6));
+      assert(chck_rope_flatten(&rope) == flat);
+      assert(chck_rope_read_int(&u16, CHCK_BUFFER_B16, &rope) && u16 == 0x1234);
+      chck_rope_release(&rope);
+
+      assert(chck_rope(&rope, CHCK_ENDIANESS_NATIVE) && !chck_rope_flatten(&rope));
+      assert(!chck_rope_read_string(&str, &len, &rope) && !str && !len);
+
+      // bulk ints, varints, and views across owned and referenced segments
+      assert(chck_rope(&rope, CHCK_ENDIANESS_BIG));
+      const uint32_t ints[] = { 1, 0x01020304, UINT32_MAX, 42, 7 };
+      assert(chck_rope_write_ints(ints, CHCK_BUFFER_B32, 3, &rope) == 3);
+      const uint8_t be[] = { 0, 0, 0, 42, 0, 0 }, be_tail[] = { 0, 7 };
+      assert(chck_rope_write_ref(be, sizeof(be), &rope));
+      assert(chck_rope_write_ref(be_tail, sizeof(be_tail), &rope));
+      assert(!memcmp(rope.segments[0].data, "\x0\x0\x0\x1\x1\x2\x3\x4", 8));
+
+      uint32_t rints[6];
+      assert(chck_rope_read_ints(rints, CHCK_BUFFER_B32, 6, &rope) == 5);
+      assert(!memcmp(rints, ints, sizeof(ints)));
+
+      uint64_t vsrc[300], vdst[300];
+      for (size_t i = 0; i < 300; ++i)
+         vsrc[i] = (i % 3 ? i : UINT64_C(1) << (i % 64));
+
+      struct chck_rope varints;
+      assert(chck_rope(&varints, CHCK_ENDIANESS_NATIVE));
+      assert(chck_rope_write_varints(vsrc, 150, &varints) == 150);
+      assert(chck_rope_write_varint_signed(-300, &varints));
+
+      // second half split to 3 byte referenced pieces, so varints span segments
+      struct chck_buffer enc;
+      assert(chck_buffer(&enc, 0, CHCK_ENDIANESS_NATIVE));
+      assert(chck_buffer_write_varints(vsrc + 150, 150, &enc) == 150);
+      for (size_t off = 0; off < enc.size; off += 3)
+         assert(chck_rope_write_ref(enc.buffer + off, (enc.size - off < 3 ? enc.size - off : 3), &varints));
+      assert(chck_rope_write_varint(UINT64_MAX, &varints));
+
+      int64_t sv;
+      assert(chck_rope_read_varints(vdst, 150, &varints) == 150);
+      assert(chck_rope_read_varint_signed(&sv, &varints) && sv == -300);
+      assert(chck_rope_read_varints(vdst + 150, 150, &varints) == 150);
+      assert(!memcmp(vsrc, vdst, sizeof(vsrc)));
+      assert(chck_rope_read_varint(&v, &varints) && v == UINT64_MAX && varints.position == varints.size);
+      chck_buffer_release(&enc);
+      chck_rope_release(&varints);
+
+      // views fail with position untouched when spanning segments, and work after flatten
+      chck_rope_release(&rope);
+      assert(chck_rope(&rope, CHCK_ENDIANESS_NATIVE));
+      assert(chck_rope_write_string("in", 2, &rope));
+      assert(chck_rope_write_string("span", 4, &rope));
+      assert(chck_rope_write_ref("ning", 4, &rope));
+      rope.segments[0].data[5] = 8;
+
+      const char *view;
+      const void *bytes;
+      assert(chck_rope_read_string_view(&view, &len, &rope) && len == 2 && !memcmp(view, "in", 2));
+      assert(!chck_rope_read_string_view(&view, &len, &rope) && !view && !len && rope.position == 4);
+      assert(!chck_rope_read_bytes_view(&bytes, 7, &rope) && rope.position == 4);
+      assert(chck_rope_read_bytes_view(&bytes, 6, &rope) && !memcmp(bytes, "\x1\x8span", 6));
+      chck_rope_seek(&rope, 4, SEEK_SET);
+      assert(chck_rope_flatten(&rope));
+      assert(chck_rope_read_string_view(&view, &len, &rope) && len == 8 && !memcmp(view, "spanning", 8));
+      assert(chck_rope_read_bytes_view(&bytes, 0, &rope) && !bytes);
+      chck_rope_release(&rope);
+
+      // overflowing varint split across segments
+      assert(chck_rope(&rope, CHCK_ENDIANESS_NATIVE));
+      assert(chck_rope_write_ref("\xff\xff\xff\xff\xff", 5, &rope));
+      assert(chck_rope_write_ref("\xff\xff\xff\xff\x2", 5, &rope));
+      assert(!chck_rope_read_varint(&v, &rope) && rope.position == 0);
+      chck_rope_release(&rope);
+   }
+
+   /* TEST: codecs */
+   {
+      const bool available[] = { HAS_ZLIB, HAS_LZ4, HAS_ZSTD };
+      uint8_t data[64 * 1024];
+      fill_records(data, sizeof(data));
+
+      for (enum chck_buffer_codec c = 0; c < CHCK_BUFFER_CODEC_LAST; ++c) {
+         assert(chck_buffer_has_codec(c) == available[c]);
+
+         struct chck_buffer buf;
+         assert(chck_buffer_from_pointer(&buf, data, sizeof(data), CHCK_ENDIANESS_NATIVE));
+
+         if (!available[c]) {
+            assert(!chck_buffer_codec_bound(c, sizeof(data)));
+            assert(!chck_buffer_compress(&buf, c, 0) && !chck_buffer_decompress(&buf, c));
+            assert(buf.buffer == data && buf.size == sizeof(data));
+            continue;
+         }
+
+         for (int level = 0; level < 3; ++level) {
+            assert(chck_buffer_compress(&buf, c, level));
+            assert(buf.size < sizeof(data) / 2 && buf.size <= chck_buffer_codec_bound(c, sizeof(data)));
+            assert(chck_buffer_decompress(&buf, c));
+            assert(buf.size == sizeof(data) && !memcmp(buf.buffer, data, sizeof(data)));
+         }
+
+         // garbage is not decompressed
+         memset(buf.buffer, 0xff, 32);
+         assert(chck_buffer_resize(&buf, 32));
+         assert(!chck_buffer_decompress(&buf, c));
+         chck_buffer_release(&buf);
+      }
+
+      struct chck_buffer buf;
+      assert(chck_buffer_from_pointer(&buf, data, sizeof(data), CHCK_ENDIANESS_NATIVE));
+      assert(!chck_buffer_has_codec(CHCK_BUFFER_CODEC_LAST) && !chck_buffer_compress(&buf, CHCK_BUFFER_CODEC_LAST, 0));
+      chck_buffer_release(&buf);
+   }
+
    /* TEST: benchmark read/write (small writes, native && non-native) */
    {
       const uint32_t iters = 0xFFFFF;
@@ -183,5 +931,242 @@ int main(void)
       }
    }
 
+   /* TEST: benchmark bulk ints (per-element vs bulk, non-native) */
+   {
+      const size_t memb = 1 << 20;
+      uint32_t *ints;
+      assert((ints = malloc(memb * sizeof(uint32_t))));
+      for (uint32_t i = 0; i < memb; ++i)
+         ints[i] = i;
+
+      struct chck_buffer buf;
+      assert(chck_buffer(&buf, memb * sizeof(uint32_t), !chck_endianess()));
+      assert(chck_buffer_write_ints(ints, sizeof(uint32_t), memb, &buf) == memb);
+
+      struct timespec start;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int r = 0; r < 16; ++r) {
+         chck_buffer_seek(&buf, 0, SEEK_SET);
+         for (size_t i = 0; i < memb; ++i)
+            assert(chck_buffer_read_int(&ints[i], sizeof(uint32_t), &buf));
+      }
+      const double single = elapsed(&start);
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int r = 0; r < 16; ++r) {
+         chck_buffer_seek(&buf, 0, SEEK_SET);
+         assert(chck_buffer_read_ints(ints, sizeof(uint32_t), memb, &buf) == memb);
+      }
+      const double bulk = elapsed(&start);
+
+      for (uint32_t i = 0; i < memb; ++i)
+         assert(ints[i] == i);
+
+      printf("buffer: 16M uint32 swapped, per-element: %.3fs, bulk: %.3fs\n", single, bulk);
+      chck_buffer_release(&buf);
+      free(ints);
+   }
+
+   /* TEST: benchmark varints (fixed 32-bit vs varint, single and batched) */
+   {
+      const size_t memb = 1 << 22;
+      uint64_t *lens;
+      assert((lens = malloc(memb * sizeof(uint64_t))));
+
+      // lengths of typical message fields, mostly small
+      srand(1);
+      for (size_t i = 0; i < memb; ++i)
+         lens[i] = (rand() % 8 ? rand() % 100 : rand() % 100000);
+
+      struct chck_buffer fixed, varint;
+      assert(chck_buffer(&fixed, 1, CHCK_ENDIANESS_NATIVE) && chck_buffer(&varint, 1, CHCK_ENDIANESS_NATIVE));
+      for (size_t i = 0; i < memb; ++i)
+         assert(chck_buffer_write_int((uint32_t[]){ lens[i] }, CHCK_BUFFER_B32, &fixed));
+      assert(chck_buffer_write_varints(lens, memb, &varint) == memb);
+      const size_t fixed_size = fixed.curpos - fixed.buffer, varint_size = varint.curpos - varint.buffer;
+
+      uint64_t fixed_sum = 0, single_sum = 0, batch_sum = 0, v;
+      struct timespec start;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      chck_buffer_seek(&fixed, 0, SEEK_SET);
+      for (size_t i = 0; i < memb; ++i) {
+         uint32_t t;
+         assert(chck_buffer_read_int(&t, CHCK_BUFFER_B32, &fixed));
+         fixed_sum += t;
+      }
+      const double fixed_time = elapsed(&start);
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      chck_buffer_seek(&varint, 0, SEEK_SET);
+      for (size_t i = 0; i < memb; ++i) {
+         assert(chck_buffer_read_varint(&v, &varint));
+         single_sum += v;
+      }
+      const double single_time = elapsed(&start);
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      chck_buffer_seek(&varint, 0, SEEK_SET);
+      assert(chck_buffer_read_varints(lens, memb, &varint) == memb);
+      const double batch_time = elapsed(&start);
+
+      for (size_t i = 0; i < memb; ++i)
+         batch_sum += lens[i];
+
+      assert(fixed_sum == single_sum && single_sum == batch_sum);
+      printf("buffer: 4M lengths, fixed: %zu bytes %.3fs, varint: %zu bytes %.3fs, batched: %.3fs\n", fixed_size, fixed_time, varint_size, single_time, batch_time);
+      chck_buffer_release(&fixed);
+      chck_buffer_release(&varint);
+      free(lens);
+   }
+
+   /* TEST: benchmark small appends (geometric vs linear growth) */
+   {
+      const size_t appends = 10000000;
+      for (int linear = 0; linear < 2; ++linear) {
+         struct chck_buffer buf;
+         assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+
+         // old growth, every full write grew the buffer by step
+         if (linear)
+            buf.max_step = buf.step;
+
+         struct timespec start;
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         for (size_t i = 0; i < appends; ++i)
+            assert(chck_buffer_write("append", 1, 6, &buf) == 6);
+
+         printf("buffer: %zu small appends, %s: %.3fs\n", appends, (linear ? "linear" : "geometric"), elapsed(&start));
+         assert(buf.size == appends * 6);
+         chck_buffer_release(&buf);
+      }
+   }
+
+   /* TEST: benchmark text (printf vs fast writers) */
+   {
+      const size_t iters = 1000000;
+      for (int fast = 0; fast < 2; ++fast) {
+         struct chck_buffer buf;
+         assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+
+         struct timespec start;
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         for (uint64_t v = 0; v < iters; ++v) {
+            if (fast) {
+               assert(chck_buffer_write_u64_dec(v * 7919, &buf) > 0);
+               assert(chck_buffer_write(" ", 1, 1, &buf) == 1);
+               assert(chck_buffer_write_double(v / 8.0, 3, &buf) > 0);
+               assert(chck_buffer_write("\n", 1, 1, &buf) == 1);
+            } else {
+               assert(chck_buffer_write_format(&buf, "%" PRIu64 " %.3f\n", v * 7919, v / 8.0) > 0);
+            }
+         }
+
+         printf("buffer: 1M log lines, %s: %.3fs\n", (fast ? "fast writers" : "format"), elapsed(&start));
+         chck_buffer_release(&buf);
+      }
+   }
+
+   /* TEST: benchmark fd copy (through buffer vs in kernel) */
+   {
+      const size_t size = 64 * 1024 * 1024;
+      FILE *a, *b;
+      assert((a = tmpfile()) && (b = tmpfile()));
+      assert(ftruncate(fileno(a), size) == 0);
+
+      for (int kernel = 0; kernel < 2; ++kernel) {
+         assert(lseek(fileno(a), 0, SEEK_SET) == 0 && lseek(fileno(b), 0, SEEK_SET) == 0);
+
+         struct timespec start;
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         if (kernel) {
+            assert(chck_buffer_copy_fd(fileno(b), fileno(a), size) == size);
+         } else {
+            struct chck_buffer buf;
+            assert(chck_buffer(&buf, 0, CHCK_ENDIANESS_NATIVE));
+            assert(chck_buffer_write_from_fd(fileno(a), 1, size, &buf) == size);
+            chck_buffer_seek(&buf, 0, SEEK_SET);
+            assert(chck_buffer_write_to_fd(fileno(b), &buf, 1) == size);
+            chck_buffer_release(&buf);
+         }
+
+         printf("buffer: 64MB file copy, %s: %.3fs\n", (kernel ? "in kernel" : "through buffer"), elapsed(&start));
+      }
+
+      fclose(a);
+      fclose(b);
+   }
+
+   /* TEST: benchmark scatter output (copy to buffer vs rope of references) */
+   {
+      enum { FRAGMENTS = 4096, FRAGMENT = 1024, ROUNDS = 64 };
+      uint8_t *data;
+      assert((data = malloc(FRAGMENTS * FRAGMENT)));
+      memset(data, 'x', FRAGMENTS * FRAGMENT);
+
+      int fd;
+      assert((fd = open("/dev/null", O_WRONLY)) >= 0);
+
+      for (int rope = 0; rope < 2; ++rope) {
+         struct timespec start;
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         for (int r = 0; r < ROUNDS; ++r) {
+            if (rope) {
+               struct chck_rope out;
+               assert(chck_rope(&out, CHCK_ENDIANESS_NATIVE));
+               for (size_t i = 0; i < FRAGMENTS; ++i)
+                  assert(chck_rope_write_ref(data + i * FRAGMENT, FRAGMENT, &out));
+               assert(chck_rope_write_to_fd(fd, &out) == FRAGMENTS * FRAGMENT);
+               chck_rope_release(&out);
+            } else {
+               struct chck_buffer out;
+               assert(chck_buffer(&out, 0, CHCK_ENDIANESS_NATIVE));
+               for (size_t i = 0; i < FRAGMENTS; ++i)
+                  assert(chck_buffer_write(data + i * FRAGMENT, 1, FRAGMENT, &out) == FRAGMENT);
+               chck_buffer_seek(&out, 0, SEEK_SET);
+               assert(chck_buffer_write_to_fd(fd, &out, 1) == FRAGMENTS * FRAGMENT);
+               chck_buffer_release(&out);
+            }
+         }
+
+         printf("buffer: %dx 4096 1KiB fragments to fd, %s: %.3fs\n", ROUNDS, (rope ? "rope writev" : "buffer copy"), elapsed(&start));
+      }
+
+      close(fd);
+      free(data);
+   }
+
+   /* TEST: benchmark codecs (ratio and MB/s) */
+   {
+      const char *names[] = { "zlib", "lz4", "zstd" };
+      const size_t size = 16 * 1024 * 1024;
+      uint8_t *data;
+      assert((data = malloc(size)));
+      fill_records(data, size);
+
+      for (enum chck_buffer_codec c = 0; c < CHCK_BUFFER_CODEC_LAST; ++c) {
+         if (!chck_buffer_has_codec(c))
+            continue;
+
+         struct chck_buffer buf;
+         assert(chck_buffer_from_pointer(&buf, data, size, CHCK_ENDIANESS_NATIVE));
+
+         struct timespec start;
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         assert(chck_buffer_compress(&buf, c, 0));
+         const double compress = elapsed(&start);
+         const size_t compressed = buf.size;
+
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         assert(chck_buffer_decompress(&buf, c));
+         const double decompress = elapsed(&start);
+
+         assert(buf.size == size && !memcmp(buf.buffer, data, size));
+         printf("buffer: %-4s ratio %.2f, compress %.0f MB/s, decompress %.0f MB/s\n", names[c], (double)size / compressed, size / compress / 1e6, size / decompress / 1e6);
+         chck_buffer_release(&buf);
+      }
+
+      free(data);
+   }
+
    return EXIT_SUCCESS;
 }
@@ -4,6 +4,14 @@
 #include <string.h> /* for memcpy */
 #include <assert.h> /* for assert */
 
+#if defined(_WIN32) || defined(_WIN64)
+#  include <windows.h>
+#  define cpu_yield() SwitchToThread()
+#else
+#  include <sched.h>
+#  define cpu_yield() sched_yield()
+#endif
+
 static void
 pool_buffer_flush(struct chck_pool_buffer *pb, bool release)
 {
@@ -443,6 +451,299 @@ chck_pool_to_c_array(struct chck_pool *pool, size_t *out_memb)
    return pool_buffer_to_c_array(&pool->items, out_memb);
 }
 
+static bool
+pool_buffer_extend(struct chck_pool_buffer *pb)
+{
+   assert(pb && pb->member > 0);
+
+   while (pb->allocated < pb->used + pb->member) {
+      if (unlikely(!pool_buffer_resize_add(pb, pb->allocated, pb->step)))
+         return false;
+   }
+
+   memset(pb->buffer + pb->used, 0, pb->member);
+   __atomic_store_n(&pb->used, pb->used + pb->member, __ATOMIC_RELAXED);
+   return true;
+}
+
+static bool
+pool_has_capacity(const struct chck_pool *pool, size_t memb)
+{
+   assert(pool);
+
+   if (pool->removed.count >= memb)
+      return true;
+
+   memb -= pool->removed.count;
+   return (pool->items.used + memb * pool->items.member <= pool->items.allocated &&
+           pool->map.used + memb * pool->map.member <= pool->map.allocated);
+}
+
+static size_t
+pool_claim(struct chck_pool *pool, size_t *out_indices, size_t memb)
+{
+   assert(pool && out_indices);
+
+   // reuse holes first, same as pool_get_free_slot
+   size_t claimed = (pool->removed.count < memb ? pool->removed.count : memb);
+   if (claimed > 0) {
+      pool->removed.count -= claimed;
+      pool->removed.used -= claimed * pool->removed.member;
+      memcpy(out_indices, pool->removed.buffer + pool->removed.used, claimed * pool->removed.member);
+   }
+
+   // claimed slots stay unmapped, so they look like holes until the cache adds item to them
+   for (; claimed < memb; ++claimed) {
+      const size_t slot = pool->items.used / pool->items.member;
+
+      if (unlikely(!pool_buffer_extend(&pool->items)))
+         break;
+
+      if (unlikely(!pool_buffer_extend(&pool->map))) {
+         pool->items.used -= pool->items.member;
+         break;
+      }
+
+      out_indices[claimed] = slot;
+   }
+
+   return claimed;
+}
+
+static bool
+pool_unclaim(struct chck_pool *pool, const size_t *indices, size_t memb)
+{
+   assert(pool && indices);
+
+   size_t size;
+   if (unlikely(chck_mul_ofsz(memb, pool->removed.member, &size)))
+      return false;
+
+   // Some heuristics to avoid large amount of heap allocations
+   // Caches may be adding and removing items concurrently, so count is loaded atomically.
+   const size_t count = __atomic_load_n(&pool->items.count, __ATOMIC_RELAXED);
+   pool->removed.step = (pool->items.step < count / 2 ? count / 2 : pool->items.step);
+
+   while (pool->removed.allocated < pool->removed.used + size) {
+      // Heuristic step may be too large to allocate, exact fit is tried before giving up.
+      if (unlikely(!pool_buffer_resize_add(&pool->removed, pool->removed.allocated, pool->removed.step)) &&
+          unlikely(!pool_buffer_resize_add(&pool->removed, pool->removed.used, size)))
+         return false;
+   }
+
+   memcpy(pool->removed.buffer + pool->removed.used, indices, size);
+   pool->removed.used += size;
+   pool->removed.count += memb;
+   return true;
+}
+
+static void
+pool_lock(struct chck_pool *pool)
+{
+   assert(pool);
+   while (__atomic_test_and_set(&pool->concurrent.lock, __ATOMIC_ACQUIRE))
+      cpu_yield();
+}
+
+static void
+pool_unlock(struct chck_pool *pool)
+{
+   assert(pool);
+   __atomic_clear(&pool->concurrent.lock, __ATOMIC_RELEASE);
+}
+
+static void
+cache_enter(struct chck_pool_cache *cache)
+{
+   assert(cache && cache->pool);
+
+   while (true) {
+      __atomic_store_n(&cache->active, true, __ATOMIC_SEQ_CST);
+
+      if (likely(!__atomic_load_n(&cache->pool->concurrent.resizing, __ATOMIC_SEQ_CST)))
+         return;
+
+      // Another thread is resizing the buffers, step out of its way.
+      __atomic_store_n(&cache->active, false, __ATOMIC_RELEASE);
+
+      while (__atomic_load_n(&cache->pool->concurrent.resizing, __ATOMIC_ACQUIRE))
+         cpu_yield();
+   }
+}
+
+static void
+cache_leave(struct chck_pool_cache *cache)
+{
+   assert(cache);
+   __atomic_store_n(&cache->active, false, __ATOMIC_RELEASE);
+}
+
+static bool
+cache_refill(struct chck_pool_cache *cache)
+{
+   assert(cache && cache->pool && !cache->active);
+   struct chck_pool *pool = cache->pool;
+   const size_t batch = CHCK_POOL_CACHE_SIZE / 2;
+
+   pool_lock(pool);
+
+   // Growing reallocates the buffers, so wait until no thread is inside them.
+   const bool resize = !pool_has_capacity(pool, batch);
+   if (resize) {
+      __atomic_store_n(&pool->concurrent.resizing, true, __ATOMIC_SEQ_CST);
+
+      for (struct chck_pool_cache *c = pool->concurrent.caches; c; c = c->next) {
+         while (__atomic_load_n(&c->active, __ATOMIC_ACQUIRE))
+            cpu_yield();
+      }
+   }
+
+   cache->count += pool_claim(pool, cache->indices + cache->count, batch);
+
+   if (resize)
+      __atomic_store_n(&pool->concurrent.resizing, false, __ATOMIC_RELEASE);
+
+   pool_unlock(pool);
+   return (cache->count > 0);
+}
+
+static bool
+cache_flush(struct chck_pool_cache *cache, size_t memb)
+{
+   assert(cache && cache->pool && memb <= cache->count);
+
+   // return the oldest indices, the most recently freed ones are likely hot in cache
+   pool_lock(cache->pool);
+   const bool flushed = pool_unclaim(cache->pool, cache->indices, memb);
+   pool_unlock(cache->pool);
+
+   if (unlikely(!flushed))
+      return false;
+
+   memmove(cache->indices, cache->indices + memb, (cache->count - memb) * sizeof(size_t));
+   cache->count -= memb;
+   return true;
+}
+
+bool
+chck_pool_cache(struct chck_pool_cache *cache, struct chck_pool *pool)
+{
+   assert(cache && pool);
+
+   if (unlikely(!pool->items.member))
+      return false;
+
+   *cache = (struct chck_pool_cache){ .pool = pool };
+
+   pool_lock(pool);
+   cache->next = pool->concurrent.caches;
+   pool->concurrent.caches = cache;
+   pool_unlock(pool);
+   return true;
+}
+
+void
+chck_pool_cache_release(struct chck_pool_cache *cache)
+{
+   if (!cache || !cache->pool)
+      return;
+
+   // Try smaller batches if pool can't grow enough to take everything back at once.
+   // Indices it still can't take are left as holes, cache is unlinked regardless.
+   for (size_t memb = cache->count; cache->count > 0 && memb > 0;) {
+      if (!cache_flush(cache, (memb < cache->count ? memb : cache->count)))
+         memb /= 2;
+   }
+
+   pool_lock(cache->pool);
+   for (struct chck_pool_cache **c = &cache->pool->concurrent.caches; *c; c = &(*c)->next) {
+      if (*c != cache)
+         continue;
+
+      *c = cache->next;
+      break;
+   }
+   pool_unlock(cache->pool);
+
+   *cache = (struct chck_pool_cache){0};
+}
+
+bool
+chck_pool_cache_add(struct chck_pool_cache *cache, const void *data, size_t *out_index)
+{
+   assert(cache && cache->pool);
+
+   if (!cache->count && !cache_refill(cache))
+      return false;
+
+   struct chck_pool *pool = cache->pool;
+   const size_t index = cache->indices[--cache->count];
+
+   cache_enter(cache);
+   uint8_t *ptr = pool->items.buffer + index * pool->items.member;
+
+   if (data) {
+      memcpy(ptr, data, pool->items.member);
+   } else {
+      memset(ptr, 0, pool->items.member);
+   }
+
+   __atomic_store_n(&((bool*)pool->map.buffer)[index], true, __ATOMIC_RELEASE);
+   cache_leave(cache);
+
+   __atomic_add_fetch(&pool->items.count, 1, __ATOMIC_RELAXED);
+
+   if (out_index)
+      *out_index = index;
+
+   return true;
+}
+
+void
+chck_pool_cache_remove(struct chck_pool_cache *cache, size_t index)
+{
+   assert(cache && cache->pool);
+   struct chck_pool *pool = cache->pool;
+
+   cache_enter(cache);
+
+   // exchange, so only one of the threads removing same index gets to cache it
+   bool mapped = false;
+   if (likely(index < __atomic_load_n(&pool->map.used, __ATOMIC_RELAXED) / pool->map.member))
+      mapped = __atomic_exchange_n(&((bool*)pool->map.buffer)[index], false, __ATOMIC_ACQ_REL);
+
+   cache_leave(cache);
+
+   if (unlikely(!mapped))
+      return;
+
+   __atomic_sub_fetch(&pool->items.count, 1, __ATOMIC_RELAXED);
+
+   if (cache->count >= CHCK_POOL_CACHE_SIZE)
+      cache_flush(cache, CHCK_POOL_CACHE_SIZE / 2);
+
+   // if flush failed, leak the slot rather than lose track of it in the map
+   if (likely(cache->count < CHCK_POOL_CACHE_SIZE))
+      cache->indices[cache->count++] = index;
+}
+
+bool
+chck_pool_cache_get(struct chck_pool_cache *cache, size_t index, void *out_data)
+{
+   assert(cache && cache->pool && out_data);
+   struct chck_pool *pool = cache->pool;
+
+   cache_enter(cache);
+
+   bool mapped = false;
+   if (likely(index < __atomic_load_n(&pool->map.used, __ATOMIC_RELAXED) / pool->map.member) &&
+       (mapped = __atomic_load_n(&((bool*)pool->map.buffer)[index], __ATOMIC_ACQUIRE)))
+      memcpy(out_data, pool->items.buffer + index * pool->items.member, pool->items.member);
+
+   cache_leave(cache);
+   return mapped;
+}
+
 bool
 chck_iter_pool(struct chck_iter_pool *pool, size_t grow, size_t capacity, size_t member_size)
 {
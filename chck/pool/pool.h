@@ -21,10 +21,32 @@ struct chck_pool_buffer {
    size_t count;
 };
 
+struct chck_pool_cache;
+
 struct chck_pool {
    struct chck_pool_buffer items;
    struct chck_pool_buffer map;
    struct chck_pool_buffer removed;
+
+   // shared state for concurrent mode (see chck_pool_cache)
+   struct {
+      struct chck_pool_cache *caches;
+      bool lock, resizing;
+   } concurrent;
+};
+
+#define CHCK_POOL_CACHE_SIZE 64
+
+struct chck_pool_cache {
+   // free indices owned by this thread, refilled from and flushed to pool's removed list in batches
+   size_t indices[CHCK_POOL_CACHE_SIZE];
+   size_t count;
+
+   // true while this thread touches the pool buffers, buffers are only resized when every cache is inactive
+   bool active;
+
+   struct chck_pool *pool;
+   struct chck_pool_cache *next;
 };
 
 struct chck_iter_pool {
@@ -72,6 +94,23 @@ void* chck_pool_iter(const struct chck_pool *pool, size_t *iter, bool reverse);
 bool chck_pool_set_c_array(struct chck_pool *pool, const void *items, size_t memb); /* struct item *c_array; */
 void* chck_pool_to_c_array(struct chck_pool *pool, size_t *memb); /* struct item *c_array; (contains holes) */
 
+/**
+ * Concurrent mode for pools shared between threads.
+ * Each thread registers its own chck_pool_cache and adds/removes items through it.
+ * Free indices are cached per thread and moved from/to the pool in batches,
+ * so most operations don't touch any shared state.
+ *
+ * While caches are registered, the non-cache chck_pool functions must not be called.
+ * Items can only be accessed by copying with chck_pool_cache_get, as any thread may resize the pool.
+ * Indices held by caches show up as holes until the cache is released.
+ */
+
+bool chck_pool_cache(struct chck_pool_cache *cache, struct chck_pool *pool);
+void chck_pool_cache_release(struct chck_pool_cache *cache);
+bool chck_pool_cache_add(struct chck_pool_cache *cache, const void *data, size_t *out_index);
+void chck_pool_cache_remove(struct chck_pool_cache *cache, size_t index);
+bool chck_pool_cache_get(struct chck_pool_cache *cache, size_t index, void *out_data);
+
 /**
  * IterPools don't have holes in buffer.
  * Whenever you remove a item from IterPool, the items after that get memmoved.
@@ -4,6 +4,11 @@
 #include <string.h>
 #include <stdint.h>
 
+#if HAS_PTHREAD
+#  include <pthread.h>
+#  include <time.h>
+#endif
+
 #undef NDEBUG
 #include <assert.h>
 
@@ -17,6 +22,102 @@ static void printa(struct item *item)
    printf("item::%d\n", item->a);
 }
 
+#if HAS_PTHREAD
+struct bench {
+   struct chck_pool *pool;
+   pthread_mutex_t *mutex;
+   size_t iters;
+};
+
+static void*
+bench_cache(void *arg)
+{
+   struct bench *b = arg;
+   struct chck_pool_cache cache;
+   assert(chck_pool_cache(&cache, b->pool));
+
+   size_t indices[16];
+   for (size_t i = 0; i < b->iters; ++i) {
+      for (uint32_t x = 0; x < 16; ++x)
+         assert(chck_pool_cache_add(&cache, (&(struct item){x, NULL}), &indices[x]));
+
+      for (uint32_t x = 0; x < 16; ++x) {
+         struct item item;
+         assert(chck_pool_cache_get(&cache, indices[x], &item) && item.a == x);
+         chck_pool_cache_remove(&cache, indices[x]);
+      }
+   }
+
+   chck_pool_cache_release(&cache);
+   return NULL;
+}
+
+static void*
+bench_mutex(void *arg)
+{
+   struct bench *b = arg;
+
+   size_t indices[16];
+   for (size_t i = 0; i < b->iters; ++i) {
+      for (uint32_t x = 0; x < 16; ++x) {
+         pthread_mutex_lock(b->mutex);
+         assert(chck_pool_add(b->pool, (&(struct item){x, NULL}), &indices[x]));
+         pthread_mutex_unlock(b->mutex);
+      }
+
+      for (uint32_t x = 0; x < 16; ++x) {
+         pthread_mutex_lock(b->mutex);
+         chck_pool_remove(b->pool, indices[x]);
+         pthread_mutex_unlock(b->mutex);
+      }
+   }
+
+   return NULL;
+}
+
+static void*
+remove_all(void *arg)
+{
+   struct bench *b = arg;
+   struct chck_pool_cache cache;
+   assert(chck_pool_cache(&cache, b->pool));
+
+   // every thread removes the same indices
+   for (size_t i = 0; i < b->iters; ++i)
+      chck_pool_cache_remove(&cache, i);
+
+   chck_pool_cache_release(&cache);
+   return NULL;
+}
+
+static double
+bench_run(size_t nthreads, size_t iters, void* (*function)(void*), pthread_mutex_t *mutex)
+{
+   struct chck_pool pool;
+   assert(chck_pool(&pool, 32, 0, sizeof(struct item)));
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   pthread_t threads[32];
+   struct bench b = { &pool, mutex, iters / nthreads };
+   for (size_t i = 0; i < nthreads; ++i)
+      assert(pthread_create(&threads[i], NULL, function, &b) == 0);
+
+   for (size_t i = 0; i < nthreads; ++i)
+      pthread_join(threads[i], NULL);
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   assert(pool.items.count == 0);
+   assert(!pool.concurrent.caches);
+   chck_pool_release(&pool);
+
+   const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return (b.iters * nthreads * 16 * 2) / secs / 1e6;
+}
+#endif
+
 int main(void)
 {
    struct item dummy = {0};
@@ -370,5 +471,93 @@ int main(void)
       assert(pool.items.allocated == 0);
    }
 
+#if HAS_PTHREAD
+   /* TEST: concurrent pool cache */
+   {
+      struct chck_pool pool;
+      assert(chck_pool(&pool, 32, 0, sizeof(struct item)));
+
+      struct chck_pool_cache cache;
+      assert(chck_pool_cache(&cache, &pool));
+      assert(pool.concurrent.caches == &cache);
+
+      size_t a, b;
+      assert(chck_pool_cache_add(&cache, (&(struct item){1, NULL}), &a));
+      assert(chck_pool_cache_add(&cache, (&(struct item){2, NULL}), &b));
+      assert(a != b);
+      assert(pool.items.count == 2);
+      assert(cache.count == CHCK_POOL_CACHE_SIZE / 2 - 2);
+
+      struct item item;
+      assert(chck_pool_cache_get(&cache, a, &item) && item.a == 1);
+      assert(chck_pool_cache_get(&cache, b, &item) && item.a == 2);
+
+      chck_pool_cache_remove(&cache, a);
+      assert(!chck_pool_cache_get(&cache, a, &item));
+      assert(pool.items.count == 1);
+
+      // removing twice must not put the index in cache twice
+      const size_t cached = cache.count;
+      chck_pool_cache_remove(&cache, a);
+      assert(cache.count == cached);
+
+      // flushing returns the indices to the pool as holes
+      chck_pool_cache_release(&cache);
+      assert(!pool.concurrent.caches);
+      assert(pool.removed.count == CHCK_POOL_CACHE_SIZE / 2 - 1);
+      assert(((struct item*)chck_pool_get(&pool, b))->a == 2);
+
+      {
+         size_t aa = 0;
+         struct item *current;
+         chck_pool_for_each(&pool, current) {
+            assert(current->a == 2);
+            ++aa;
+         }
+         assert(aa == 1);
+      }
+
+      // normal pool functions work again after caches are released
+      size_t c;
+      assert(chck_pool_add(&pool, (&(struct item){3, NULL}), &c));
+      assert(((struct item*)chck_pool_get(&pool, c))->a == 3);
+      chck_pool_release(&pool);
+
+      // racing removals of same indices count each index once
+      for (int r = 0; r < 16; ++r) {
+         assert(chck_pool(&pool, 32, 0, sizeof(struct item)));
+         for (uint32_t i = 0; i < 1024; ++i)
+            assert(chck_pool_add(&pool, (&(struct item){i, NULL}), NULL));
+
+         pthread_t threads[4];
+         struct bench rb = { &pool, NULL, 1024 };
+         for (size_t i = 0; i < 4; ++i)
+            assert(pthread_create(&threads[i], NULL, remove_all, &rb) == 0);
+
+         for (size_t i = 0; i < 4; ++i)
+            pthread_join(threads[i], NULL);
+
+         assert(pool.items.count == 0);
+         assert(pool.removed.count == 1024);
+         chck_pool_release(&pool);
+      }
+   }
+
+   /* TEST: benchmark (concurrent pool scaling, 1-32 threads) */
+   {
+      pthread_mutex_t mutex;
+      assert(pthread_mutex_init(&mutex, NULL) == 0);
+
+      const size_t iters = 0x7FFF;
+      for (size_t nthreads = 1; nthreads <= 32; nthreads *= 2) {
+         const double cache = bench_run(nthreads, iters, bench_cache, NULL);
+         const double locked = bench_run(nthreads, iters, bench_mutex, &mutex);
+         printf("pool: %2zu threads, cache: %8.2f Mops/s, mutex: %8.2f Mops/s\n", nthreads, cache, locked);
+      }
+
+      pthread_mutex_destroy(&mutex);
+   }
+#endif
+
    return EXIT_SUCCESS;
 }
@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE // pthread_setname_np, pthread_attr_setaffinity_np
+#endif
+
 #include "queue.h"
 #include <chck/overflow/overflow.h>
 #include <unistd.h>
@@ -5,8 +9,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+#include <errno.h>
 #include <assert.h>
 
+#include <sched.h>
+
+#ifdef __linux__
+#  include <sys/eventfd.h>
+#endif
+
 #if HAS_VALGRIND
 #  include <valgrind/helgrind.h>
 #else
@@ -14,6 +26,128 @@
 #  define VALGRIND_HG_ENABLE_CHECKING(x, y) ;
 #endif
 
+// Most tasks a worker dequeues under one lock with the shared scheduler.
+#define DEQUEUE_BATCH 32
+
+// Capacity of per-worker deque, also the most a worker claims from the ring at once.
+#define DEQUE_SIZE 256
+
+// Default for every how many tasks a worker takes from the lowest lane instead of the highest.
+#define LANE_QUOTA 8
+
+// Every how many rounds spinning worker yields the cpu.
+#define SPIN_YIELD 64
+
+// Chase-Lev work stealing deque.
+// Owner pushes and takes from bottom, thieves steal from top.
+// See "Correct and Efficient Work-Stealing for Weak Memory Models" by Lê et al.
+struct chck_tqueue_deque {
+   int64_t top, bottom;
+   size_t slots[DEQUE_SIZE];
+};
+
+enum worker_state {
+   WORKER_STOPPED,
+   WORKER_RUNNING,
+   // exited on idle timeout, and waits to be joined
+   WORKER_EXITED,
+};
+
+struct chck_tqueue_worker {
+   struct chck_tqueue *tqueue;
+   enum worker_state state;
+
+   // Completed slots, pushed only by this worker and popped only by collect.
+   // At most qsize slots are in use, so this never overflows.
+   struct {
+      size_t *slots;
+      size_t head, tail;
+   } done;
+
+   // Tasks taken so far, for lane quota.
+   size_t turns;
+
+   // Lane of the latest batch claimed into the deque.
+   size_t lane;
+
+   struct chck_tqueue_deque deque;
+};
+
+// Parallel for/reduce job, lives on the stack of the calling thread.
+struct chck_tqueue_job {
+   void (*fn)(size_t begin, size_t end, void *userdata);
+   void (*reduce)(size_t begin, size_t end, void *partial, void *userdata);
+   void (*combine)(void *result, const void *partial, void *userdata);
+   void *userdata, *result;
+
+   // next unclaimed index, claimed in chunks of at least grain
+   size_t next, end, grain;
+
+   // partial results for reduce, one for each thread that may take part
+   uint8_t *partials;
+   size_t rsize, parts, participants;
+
+   // workers currently helping, protected by tasks mutex
+   size_t refs;
+};
+
+// Bounded MPMC ring, see "Bounded MPMC queue" by Dmitry Vyukov.
+// Cell is free for position pos when its sequence is pos, and holds value of pos when sequence is pos + 1.
+struct chck_tqueue_cell {
+   size_t sequence, value;
+};
+
+struct chck_tqueue_ring {
+   size_t head, tail, size;
+   struct chck_tqueue_cell *cells;
+};
+
+// End of edge list, and list of node whose work is done.
+#define EDGE_NONE ((size_t)-1)
+#define EDGE_CLOSED ((size_t)-2)
+
+enum node_state {
+   NODE_QUEUED,
+   NODE_STARTED,
+   NODE_CANCELLED,
+};
+
+// Edges of a slot are at slot * CHCK_TQUEUE_MAX_DEPS, so edge knows its dependent.
+struct chck_tqueue_node {
+   // bumped when slot is retired, so handles to older tasks refer to finished ones
+   size_t generation;
+
+   // unfinished dependencies, +1 while dependencies are being linked
+   size_t pending;
+
+   // lock-free list of dependents waiting for us, EDGE_CLOSED when our work is done
+   size_t head;
+
+   // worker and chck_tqueue_cancel_task race to move task out of NODE_QUEUED
+   enum node_state state;
+};
+
+#if HAS_TQUEUE_STATS
+struct chck_tqueue_counters {
+   // when task in each slot was dispatched and started
+   uint64_t *queued, *started;
+
+   struct chck_tqueue_worker_stats *workers;
+   uint64_t dispatched, completed, full, blocked;
+   struct chck_tqueue_histogram wait, work, collect;
+
+   // time integral of depth, protected by tasks mutex
+   uint64_t epoch, sampled, depth_ns;
+   size_t depth, max_depth;
+};
+#endif
+
+enum steal_result {
+   STEAL_EMPTY,
+   STEAL_ABORT,
+   STEAL_OK,
+};
+
 static bool
 creator_thread(const struct chck_tqueue *tqueue, const char *function)
 {
@@ -26,6 +160,131 @@ creator_thread(const struct chck_tqueue *tqueue, const char *function)
 }
 #define creator_thread(x) creator_thread(x, __func__)
 
+static void
+deadline_after(uint64_t timeout_ns, struct timespec *out_deadline)
+{
+   assert(out_deadline);
+   clock_gettime(CLOCK_MONOTONIC, out_deadline);
+   out_deadline->tv_sec += timeout_ns / 1000000000;
+   out_deadline->tv_nsec += timeout_ns % 1000000000;
+
+   if (out_deadline->tv_nsec >= 1000000000) {
+      out_deadline->tv_sec += 1;
+      out_deadline->tv_nsec -= 1000000000;
+   }
+}
+
+#if HAS_TQUEUE_STATS
+static uint64_t
+now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+record(struct chck_tqueue_histogram *histogram, uint64_t ns)
+{
+   assert(histogram);
+
+   // Updated by many workers at once, snapshot may see the fields out of sync.
+   const size_t bucket = (ns > 0 ? 63 - __builtin_clzll(ns) : 0);
+   __atomic_add_fetch(&histogram->buckets[(bucket < CHCK_TQUEUE_HISTOGRAM_BUCKETS ? bucket : CHCK_TQUEUE_HISTOGRAM_BUCKETS - 1)], 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&histogram->sum_ns, ns, __ATOMIC_RELAXED);
+
+   uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+   while (ns > max && !__atomic_compare_exchange_n(&histogram->max_ns, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void
+stats_depth(struct chck_tasks *tasks)
+{
+   assert(tasks);
+   struct chck_tqueue_counters *c = tasks->stats;
+
+   // Must be called with mutex held, after count changes.
+   const uint64_t now = now_ns();
+   c->depth_ns += c->depth * (now - c->sampled);
+   c->sampled = now;
+   c->depth = tasks->count;
+   c->max_depth = (c->depth > c->max_depth ? c->depth : c->max_depth);
+}
+
+static void
+stats_dispatch(struct chck_tasks *tasks, const struct chck_tqueue_lane *lane, size_t memb)
+{
+   assert(tasks && lane);
+   struct chck_tqueue_counters *c = tasks->stats;
+
+   // Must be called with mutex held, before memb new slots past lane tail are dispatched.
+   const uint64_t now = now_ns();
+   for (size_t i = 0; i < memb; ++i)
+      c->queued[lane->queue[(lane->tail + i) % tasks->qsize]] = now;
+
+   __atomic_add_fetch(&c->dispatched, memb, __ATOMIC_RELAXED);
+   stats_depth(tasks);
+}
+
+static void
+stats_submit(struct chck_tasks *tasks, size_t slot)
+{
+   assert(tasks);
+   tasks->stats->queued[slot] = now_ns();
+   __atomic_add_fetch(&tasks->stats->dispatched, 1, __ATOMIC_RELAXED);
+}
+
+static void
+stats_start(struct chck_tasks *tasks, size_t slot)
+{
+   assert(tasks);
+   struct chck_tqueue_counters *c = tasks->stats;
+   c->started[slot] = now_ns();
+   record(&c->wait, c->started[slot] - c->queued[slot]);
+}
+
+static void
+stats_done(struct chck_tqueue_worker *worker, size_t slot)
+{
+   assert(worker);
+   struct chck_tqueue_counters *c = worker->tqueue->tasks.stats;
+   const uint64_t ns = now_ns() - c->started[slot];
+   record(&c->work, ns);
+
+   struct chck_tqueue_worker_stats *w = &c->workers[worker - worker->tqueue->threads.workers];
+   __atomic_add_fetch(&w->busy_ns, ns, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&w->tasks, 1, __ATOMIC_RELAXED);
+}
+
+static void
+stats_collect(struct chck_tasks *tasks, size_t slot)
+{
+   assert(tasks);
+   struct chck_tqueue_counters *c = tasks->stats;
+   record(&c->collect, now_ns() - c->started[slot]);
+   __atomic_add_fetch(&c->completed, 1, __ATOMIC_RELAXED);
+}
+
+static void
+stats_full(struct chck_tasks *tasks, bool block)
+{
+   assert(tasks);
+   __atomic_add_fetch(&tasks->stats->full, 1, __ATOMIC_RELAXED);
+
+   if (block)
+      __atomic_add_fetch(&tasks->stats->blocked, 1, __ATOMIC_RELAXED);
+}
+#else
+#  define stats_depth(x) ;
+#  define stats_dispatch(x, y, z) ;
+#  define stats_submit(x, y) ;
+#  define stats_start(x, y) ;
+#  define stats_done(x, y) ;
+#  define stats_collect(x, y) ;
+#  define stats_full(x, y) ;
+#endif
+
 static void*
 get_data(struct chck_tasks *tasks, size_t index)
 {
@@ -37,317 +296,2578 @@ get_data(struct chck_tasks *tasks, size_t index)
    return tasks->buffer + (index * tasks->msize);
 }
 
-static void*
-on_thread(void *arg)
+static bool
+deque_push(struct chck_tqueue_deque *deque, size_t index)
 {
-   assert(arg);
-   struct chck_tasks *tasks = arg;
-
-   while (true) {
-      // XXX: We could use seperate lock here for dequeueing, and have own lock for insertion.
-      pthread_mutex_lock(&tasks->mutex);
-
-      if (!tasks->cancel && !tasks->tcount)
-         pthread_cond_wait(&tasks->notify, &tasks->mutex);
+   assert(deque);
+   const int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+   const int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
 
-      if (tasks->cancel)
-         break;
+   if (b - t >= DEQUE_SIZE)
+      return false;
 
-      if (!tasks->tcount) {
-         pthread_mutex_unlock(&tasks->mutex);
-         continue;
-      }
+   __atomic_store_n(&deque->slots[b % DEQUE_SIZE], index, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+   return true;
+}
 
-      assert(tasks->tcount > 0);
-      bool *processed = &tasks->processed[tasks->thead];
-      void *data = get_data(tasks, tasks->thead);
-      void (*work)() = tasks->work;
+static bool
+deque_take(struct chck_tqueue_deque *deque, size_t *out_index)
+{
+   assert(deque && out_index);
+   const int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+   __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   int64_t t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+   if (t > b) {
+      __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+      return false;
+   }
 
-      assert(tasks->qsize > 0);
-      tasks->thead = (tasks->thead + 1) % tasks->qsize;
-      tasks->tcount -= 1;
+   *out_index = __atomic_load_n(&deque->slots[b % DEQUE_SIZE], __ATOMIC_RELAXED);
 
-      pthread_mutex_unlock(&tasks->mutex);
+   if (t < b)
+      return true;
 
-      // We only may read race against these. That's okay.
-      // The user should not meddle with the input outside of the callbacks.
-      // And tqueue won't touch the item when worker is working on it.
-      VALGRIND_HG_DISABLE_CHECKING(data, tasks->msize);
+   // Last item, race against thieves.
+   const bool won = __atomic_compare_exchange_n(&deque->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+   __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+   return won;
+}
 
-      work(data);
+static enum steal_result
+deque_steal(struct chck_tqueue_deque *deque, size_t *out_index)
+{
+   assert(deque && out_index);
+   int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   const int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
 
-      // Collectless mode when no callback specified.
-      if (!tasks->callback) {
-         if (tasks->destructor)
-            tasks->destructor(data);
+   if (t >= b)
+      return STEAL_EMPTY;
 
-         memset(data, 0, tasks->msize);
+   *out_index = __atomic_load_n(&deque->slots[t % DEQUE_SIZE], __ATOMIC_RELAXED);
 
-         pthread_mutex_lock(&tasks->mutex);
-         assert(tasks->count >= 1);
-         tasks->head = (tasks->head + 1) % tasks->qsize;
-         tasks->count -= 1;
-         pthread_mutex_unlock(&tasks->mutex);
-      } else {
-         *processed = true;
-      }
+   if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      return STEAL_ABORT;
 
-      VALGRIND_HG_ENABLE_CHECKING(data, tasks->msize);
+   return STEAL_OK;
+}
 
-      if (tasks->fd >= 0)
-         write(tasks->fd, (uint64_t[]){1}, sizeof(uint64_t));
+static void
+relax(size_t round)
+{
+   // Let others run now and then, we may share the cpu with the thread we wait for.
+   if (round % SPIN_YIELD == SPIN_YIELD - 1) {
+      sched_yield();
+      return;
    }
 
-   pthread_mutex_unlock(&tasks->mutex);
-   return NULL;
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_ia32_pause();
+#endif
 }
 
 static void
-stop(struct chck_tqueue *tqueue)
+ring_init(struct chck_tqueue_ring *ring)
 {
-   assert(tqueue);
+   assert(ring);
+   ring->head = ring->tail = 0;
 
-   if (!tqueue->threads.running)
-      return;
+   for (size_t i = 0; i < ring->size; ++i)
+      ring->cells[i].sequence = i;
+}
 
-   pthread_mutex_lock(&tqueue->tasks.mutex);
-   tqueue->tasks.cancel = true;
-   pthread_cond_broadcast(&tqueue->tasks.notify);
-   pthread_mutex_unlock(&tqueue->tasks.mutex);
+static struct chck_tqueue_ring*
+ring_create(size_t size)
+{
+   struct chck_tqueue_ring *ring;
+   if (!(ring = chck_calloc_of(1, sizeof(struct chck_tqueue_ring))))
+      return NULL;
 
-   for (size_t i = 0; i < tqueue->threads.count; ++i)
-      pthread_join(tqueue->threads.t[i], NULL);
+   if (!(ring->cells = chck_calloc_of(size, sizeof(struct chck_tqueue_cell)))) {
+      free(ring);
+      return NULL;
+   }
 
-   memset(tqueue->threads.t, 0, sizeof(*tqueue->threads.t) * tqueue->threads.count);
-   tqueue->threads.running = false;
+   ring->size = size;
+   ring_init(ring);
+   return ring;
+}
+
+static void
+ring_destroy(struct chck_tqueue_ring *ring)
+{
+   if (!ring)
+      return;
+
+   free(ring->cells);
+   free(ring);
 }
 
 static bool
-start(struct chck_tqueue *tqueue)
+ring_push(struct chck_tqueue_ring *ring, size_t value)
 {
-   assert(tqueue);
+   assert(ring);
 
-   if (tqueue->threads.running)
-      return true;
+   struct chck_tqueue_cell *cell;
+   size_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+   while (true) {
+      cell = &ring->cells[pos % ring->size];
+      const intptr_t dif = (intptr_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t)pos;
 
-   tqueue->tasks.cancel = false;
+      if (dif == 0 && __atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+         break;
 
-   for (size_t i = 0; i < tqueue->threads.count; ++i) {
-      if (pthread_create(&tqueue->threads.t[i], NULL, on_thread, &tqueue->tasks) != 0)
+      // Cell still holds value of previous lap.
+      if (dif < 0)
          return false;
+
+      if (dif > 0)
+         pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
    }
 
-   tqueue->threads.running = true;
+   cell->value = value;
+   __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
    return true;
 }
 
-bool
-chck_tqueue_add_task(struct chck_tqueue *tqueue, void *data, useconds_t block)
+static bool
+ring_pop(struct chck_tqueue_ring *ring, size_t *out_value)
 {
-   assert(tqueue && data);
-
-   if (!tqueue->threads.running && !start(tqueue))
-      return false;
+   assert(ring && out_value);
 
-   assert(tqueue->tasks.qsize > 0);
-   const size_t next = (tqueue->tasks.tail + 1) % tqueue->tasks.qsize;
-   assert(next < tqueue->tasks.qsize);
-
-   bool ret = false;
+   struct chck_tqueue_cell *cell;
+   size_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
    while (true) {
-      pthread_mutex_lock(&tqueue->tasks.mutex);
-
-      if (tqueue->tasks.count >= tqueue->tasks.qsize) {
-         if (block) {
-            pthread_mutex_unlock(&tqueue->tasks.mutex);
-
-            if (tqueue->threads.self == pthread_self() && tqueue->tasks.callback)
-               chck_tqueue_collect(tqueue);
-
-            usleep(block);
-            continue;
-         }
-         break;
-      }
+      cell = &ring->cells[pos % ring->size];
+      const intptr_t dif = (intptr_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
 
-      if (tqueue->tasks.cancel)
+      if (dif == 0 && __atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
          break;
 
-      void *ptr = get_data(&tqueue->tasks, tqueue->tasks.tail);
-      memcpy(ptr, data, tqueue->tasks.msize);
-      tqueue->tasks.processed[tqueue->tasks.tail] = false;
-      tqueue->tasks.tail = next;
-      tqueue->tasks.count += 1;
-      tqueue->tasks.tcount += 1;
+      // Cell is not written yet, producer may still be on its way to it.
+      if (dif < 0)
+         return false;
 
-      pthread_cond_signal(&tqueue->tasks.notify);
-      ret = true;
-      break;
+      if (dif > 0)
+         pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
    }
 
-   pthread_mutex_unlock(&tqueue->tasks.mutex);
-   return ret;
+   *out_value = cell->value;
+   __atomic_store_n(&cell->sequence, pos + ring->size, __ATOMIC_RELEASE);
+   return true;
 }
 
-size_t
-chck_tqueue_collect(struct chck_tqueue *tqueue)
+static void
+ring_put(struct chck_tqueue_ring *ring, size_t value)
 {
-   assert(tqueue);
-
-   // Collect is unneccessary when no callback specified
-   assert(tqueue->tasks.callback);
+   assert(ring);
 
-   // For simplicity, we only allow collection on creator thread.
-   // Collecting anywhere else does not make sense anyways.
-   if (!tqueue || !creator_thread(tqueue))
-      return 0;
+   // For rings that have space for every slot, push fails only when consumer of the previous lap
+   // has claimed the cell but not released it yet. Rings are twice the qsize, so this is rare.
+   for (size_t i = 0; !ring_push(ring, value); ++i)
+      relax(i);
+}
 
-   if (tqueue->tasks.fd >= 0) {
-      char buf[sizeof(uint64_t)];
-      read(tqueue->tasks.fd, buf, sizeof(buf));
-   }
+static bool
+ring_ready(const struct chck_tqueue_ring *ring)
+{
+   assert(ring);
+   const size_t pos = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+   return (__atomic_load_n(&ring->cells[pos % ring->size].sequence, __ATOMIC_SEQ_CST) == pos + 1);
+}
 
-   pthread_mutex_lock(&tqueue->tasks.mutex);
-   const size_t head = tqueue->tasks.head;
-   const size_t count = tqueue->tasks.count;
-   pthread_mutex_unlock(&tqueue->tasks.mutex);
+static size_t
+ring_pending(const struct chck_tqueue_ring *ring)
+{
+   assert(ring);
+   const size_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+   const size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+   return (tail > head ? tail - head : 0);
+}
 
-   // Read races again fine here.
-   // We can't enter inside until the thread is done with the item.
-   size_t processed = 0;
-   for (size_t i = head, x = 0; x < count; i = (i + 1) % tqueue->tasks.qsize, ++x) {
-      if (!tqueue->tasks.processed[i])
-         continue;
+static struct chck_tqueue_lane*
+get_lane(struct chck_tasks *tasks, size_t slot)
+{
+   assert(tasks && slot < tasks->qsize);
+   return &tasks->lanes[tasks->owners[slot]];
+}
 
-      void *data = get_data(&tqueue->tasks, i);
-      VALGRIND_HG_DISABLE_CHECKING(data, tqueue->tasks.msize);
+static bool
+starving(struct chck_tqueue_worker *worker)
+{
+   assert(worker);
+   const size_t quota = worker->tqueue->tasks.quota;
+   return (quota > 0 && ++worker->turns % quota == 0);
+}
 
-      if (tqueue->tasks.callback)
-         tqueue->tasks.callback(data);
+static void
+release_slots(struct chck_tasks *tasks, const size_t *slots, size_t memb)
+{
+   assert(tasks && (slots || !memb));
 
-      if (tqueue->tasks.destructor)
-         tqueue->tasks.destructor(data);
+   if (!memb)
+      return;
 
-      memset(data, 0, tqueue->tasks.msize);
-      VALGRIND_HG_ENABLE_CHECKING(data, tqueue->tasks.msize);
+   // Must be called with mutex held.
+   assert(tasks->count >= memb && tasks->nunused + memb <= tasks->qsize);
 
-      tqueue->tasks.processed[i] = false;
-      ++processed;
+   if (tasks->nodes) {
+      for (size_t i = 0; i < memb; ++i)
+         tasks->nodes[slots[i]].generation++;
    }
 
-   // We need to lock here however
-   pthread_mutex_lock(&tqueue->tasks.mutex);
-   assert(tqueue->tasks.count >= processed);
-   tqueue->tasks.head = (tqueue->tasks.head + processed) % tqueue->tasks.qsize;
-   tqueue->tasks.count -= processed;
-   const size_t rcount = tqueue->tasks.count;
-   pthread_mutex_unlock(&tqueue->tasks.mutex);
-
-   if (!tqueue->threads.keep_alive && !rcount)
-      stop(tqueue);
+   memcpy(tasks->unused + tasks->nunused, slots, memb * sizeof(size_t));
+   tasks->nunused += memb;
+   tasks->count -= memb;
+   stats_depth(tasks);
 
-   return rcount;
+   if (tasks->waiting)
+      pthread_cond_broadcast(&tasks->space);
 }
 
-void
-chck_tqueue_release(struct chck_tqueue *tqueue)
+static void
+release_ring_slot(struct chck_tasks *tasks, size_t slot)
 {
-   // Allowed only on creator thread.
-   if (!tqueue || (tqueue->threads.self && !creator_thread(tqueue)))
-      return;
+   assert(tasks);
 
-   stop(tqueue);
-   pthread_mutex_destroy(&tqueue->tasks.mutex);
-   pthread_cond_destroy(&tqueue->tasks.notify);
+   ring_put(tasks->available, slot);
+   __atomic_sub_fetch(&tasks->count, 1, __ATOMIC_SEQ_CST);
 
-   if (tqueue->tasks.destructor) {
-      for (size_t i = tqueue->tasks.head, x = 0; x < tqueue->tasks.count; i = (i + 1) % tqueue->tasks.qsize, ++x)
-         tqueue->tasks.destructor(get_data(&tqueue->tasks, i));
+   // Pairs with reserve_ring, either we see the waiter or it sees the slot.
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   if (__atomic_load_n(&tasks->waiting, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&tasks->mutex);
+      pthread_cond_broadcast(&tasks->space);
+      pthread_mutex_unlock(&tasks->mutex);
    }
+}
 
-   if (tqueue->tasks.fd >= 0)
-      close(tqueue->tasks.fd);
+static bool
+has_callback(const struct chck_tasks *tasks)
+{
+   assert(tasks);
 
-   free(tqueue->tasks.processed);
-   free(tqueue->tasks.buffer);
-   free(tqueue->threads.t);
-   *tqueue = (struct chck_tqueue){0};
+   for (size_t i = 0; i < tasks->nlanes; ++i) {
+      if (tasks->lanes[i].callback)
+         return true;
+   }
+
+   return false;
 }
 
-void
-chck_tqueue_set_fd(struct chck_tqueue *tqueue, int fd)
+static bool
+collectable(const struct chck_tqueue *tqueue)
 {
    assert(tqueue);
 
-   // Allowed only on creator thread.
-   if (!tqueue || !creator_thread(tqueue))
-      return;
-
-   if (tqueue->tasks.fd >= 0)
-      close(tqueue->tasks.fd);
+   for (size_t i = 0; i < tqueue->threads.count; ++i) {
+      const struct chck_tqueue_worker *w = &tqueue->threads.workers[i];
+      if (__atomic_load_n(&w->done.tail, __ATOMIC_SEQ_CST) != w->done.head)
+         return true;
+   }
 
-   tqueue->tasks.fd = dup(fd);
+   return false;
 }
 
-int
-chck_tqueue_get_fd(struct chck_tqueue *tqueue)
+static void
+wake_workers(struct chck_tqueue *tqueue, size_t sleepers, size_t memb)
 {
    assert(tqueue);
 
-   // Allowed only on creator thread.
-   if (!tqueue || !creator_thread(tqueue))
-      return -1;
+   if (!sleepers || !memb)
+      return;
 
-   return tqueue->tasks.fd;
+   if (memb >= sleepers) {
+      pthread_cond_broadcast(&tqueue->tasks.notify);
+   } else {
+      for (size_t i = 0; i < memb; ++i)
+         pthread_cond_signal(&tqueue->tasks.notify);
+   }
 }
 
-void
-chck_tqueue_set_keep_alive(struct chck_tqueue *tqueue, bool keep_alive)
+// Workers are started from dispatch, which the workers themselves may call.
+static bool spawn(struct chck_tqueue *tqueue);
+
+static void
+grow(struct chck_tqueue *tqueue, size_t pending)
 {
    assert(tqueue);
-   // Whether to destroy or keep thread alive when no tasks.
-   tqueue->threads.keep_alive = keep_alive;
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   // Must be called with mutex held, pending is number of tasks no worker has taken yet.
+   // Idle workers pick up the tasks first, new workers are started only for the rest.
+   // Woken up worker counts as idle until it takes a task, so compare against all pending tasks, not just the new ones.
+   const size_t idle = __atomic_load_n(&tasks->sleepers, __ATOMIC_SEQ_CST) + __atomic_load_n(&tasks->spinning, __ATOMIC_SEQ_CST);
+   for (size_t n = (pending > idle ? pending - idle : 0); n > 0 && __atomic_load_n(&tqueue->threads.running, __ATOMIC_ACQUIRE) && !tasks->cancel; --n) {
+      if (tqueue->threads.alive >= tqueue->threads.count || !spawn(tqueue))
+         break;
+   }
 }
 
-bool
-chck_tqueue_get_keep_alive(struct chck_tqueue *tqueue)
+static void
+dispatch(struct chck_tqueue *tqueue, size_t index, size_t memb)
 {
    assert(tqueue);
-   return tqueue->threads.keep_alive;
+   struct chck_tasks *tasks = &tqueue->tasks;
+   struct chck_tqueue_lane *lane = &tasks->lanes[index];
+
+   // Must be called with mutex held, lane queue has memb new slots at tail.
+   stats_dispatch(tasks, lane, memb);
+   lane->tail = (lane->tail + memb) % tasks->qsize;
+
+   size_t pending = 0;
+   if (tasks->scheduler == CHCK_TQUEUE_WORK_STEALING) {
+      // Workers claim from the queue at ws.claimed.
+      __atomic_add_fetch(&lane->ws.submitted, memb, __ATOMIC_SEQ_CST);
+
+      for (size_t i = 0; i < tasks->nlanes; ++i)
+         pending += __atomic_load_n(&tasks->lanes[i].ws.submitted, __ATOMIC_SEQ_CST) - __atomic_load_n(&tasks->lanes[i].ws.claimed, __ATOMIC_SEQ_CST);
+   } else {
+      lane->tcount += memb;
+      pending = __atomic_add_fetch(&tasks->tcount, memb, __ATOMIC_RELAXED);
+   }
+
+   // Spinning workers notice the tasks without being woken up.
+   grow(tqueue, pending);
+   wake_workers(tqueue, __atomic_load_n(&tasks->sleepers, __ATOMIC_SEQ_CST), memb);
 }
 
-bool
-chck_tqueue(struct chck_tqueue *tqueue, size_t nthreads, size_t qsize, size_t msize, void (*work)(), void (*callback)(), void (*destructor)())
+static void
+publish(struct chck_tqueue *tqueue, size_t slot)
 {
-   assert(tqueue && work && msize > 0);
-   *tqueue = (struct chck_tqueue){ .tasks = { .fd = - 1 } };
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+   struct chck_tqueue_lane *lane = get_lane(tasks, slot);
 
-   if (!msize || !work)
-      return false;
+   // Must be called with mutex held.
+   __atomic_store_n(&lane->queue[lane->tail], slot, __ATOMIC_RELAXED);
+   dispatch(tqueue, tasks->owners[slot], 1);
+}
 
-   if (!(tqueue->tasks.buffer = chck_calloc_of(qsize, msize)) ||
-       !(tqueue->tasks.processed = chck_calloc_of(qsize, sizeof(bool))))
-      return false;
+static void
+release_dependents(struct chck_tqueue *tqueue, size_t slot, bool cancelled)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+   struct chck_tqueue_node *nodes = __atomic_load_n(&tasks->nodes, __ATOMIC_ACQUIRE);
 
-   // We allow racy reads on this array.
-   // However we don't allow racy writes.
-   // Unfortunately some helgrind macros are unimplemented that would allow turning this off just for reads.
-   VALGRIND_HG_DISABLE_CHECKING(tqueue->tasks.processed, qsize);
+   if (!nodes)
+      return;
 
-   if (pthread_mutex_init(&tqueue->tasks.mutex, NULL) != 0 ||
-       pthread_cond_init(&tqueue->tasks.notify, NULL) != 0)
-      goto fail;
+   // Nobody can link to us after this, they see our work is done instead.
+   size_t edge = __atomic_exchange_n(&nodes[slot].head, EDGE_CLOSED, __ATOMIC_ACQ_REL);
 
-   if (!(tqueue->threads.t = chck_calloc_of(nthreads, sizeof(pthread_t))))
-      goto fail;
+   bool locked = false;
+   for (size_t next; edge != EDGE_NONE && edge != EDGE_CLOSED; edge = next) {
+      next = tasks->edges[edge];
+      const size_t dependent = edge / CHCK_TQUEUE_MAX_DEPS;
+
+      // Dependent of cancelled task is cancelled too, before it can be published by anyone.
+      enum node_state queued = NODE_QUEUED;
+      if (cancelled)
+         __atomic_compare_exchange_n(&nodes[dependent].state, &queued, NODE_CANCELLED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+
+      if (__atomic_sub_fetch(&nodes[dependent].pending, 1, __ATOMIC_ACQ_REL) > 0)
+         continue;
+
+      if (!locked) {
+         pthread_mutex_lock(&tasks->mutex);
+         locked = true;
+      }
+
+      publish(tqueue, dependent);
+   }
+
+   if (locked)
+      pthread_mutex_unlock(&tasks->mutex);
+}
+
+static void
+run(struct chck_tqueue_worker *worker, size_t slot)
+{
+   assert(worker);
+   struct chck_tasks *tasks = &worker->tqueue->tasks;
+   struct chck_tqueue_lane *lane = get_lane(tasks, slot);
+   void *data = get_data(tasks, slot);
+
+   // We only may read race against these. That's okay.
+   // The user should not meddle with the input outside of the callbacks.
+   // And tqueue won't touch the item when worker is working on it.
+   VALGRIND_HG_DISABLE_CHECKING(data, tasks->msize);
+
+   // Cancelled task skips the work, cancels its dependents and goes through collect.
+   // MPMC scheduler does not track nodes, so they may be stale there.
+   enum node_state queued = NODE_QUEUED;
+   struct chck_tqueue_node *nodes = __atomic_load_n(&tasks->nodes, __ATOMIC_ACQUIRE);
+   const bool started = (!nodes || tasks->scheduler == CHCK_TQUEUE_MPMC ||
+                         __atomic_compare_exchange_n(&nodes[slot].state, &queued, NODE_STARTED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+   if (started) {
+      stats_start(tasks, slot);
+      lane->work(data);
+      stats_done(worker, slot);
+   }
+
+   // Dependents may run right away, the data stays until collected.
+   release_dependents(worker->tqueue, slot, !started);
+
+   // Async tasks are collected for their continuation, even when lane has no callback.
+   const struct chck_tqueue_continuation *continuations = __atomic_load_n(&tasks->continuations, __ATOMIC_ACQUIRE);
+   const bool collect = (lane->callback || (continuations && continuations[slot].resume));
+
+   // Collectless mode when no callback specified.
+   if (!collect) {
+      stats_collect(tasks, slot);
+
+      if (lane->destructor)
+         lane->destructor(data);
+
+      if (tasks->zero)
+         memset(data, 0, tasks->msize);
+      VALGRIND_HG_ENABLE_CHECKING(data, tasks->msize);
+
+      if (tasks->scheduler == CHCK_TQUEUE_MPMC) {
+         release_ring_slot(tasks, slot);
+      } else {
+         pthread_mutex_lock(&tasks->mutex);
+         release_slots(tasks, &slot, 1);
+         pthread_mutex_unlock(&tasks->mutex);
+      }
+   } else {
+      VALGRIND_HG_ENABLE_CHECKING(data, tasks->msize);
+
+      if (tasks->scheduler == CHCK_TQUEUE_MPMC) {
+         ring_put(tasks->completed, slot);
+      } else {
+         const size_t tail = worker->done.tail;
+         worker->done.slots[tail % tasks->qsize] = slot;
+         __atomic_store_n(&worker->done.tail, tail + 1, __ATOMIC_SEQ_CST);
+      }
+
+      // Collector may be waiting for something to collect, pairs with wait_space and reserve_ring.
+      if (__atomic_load_n(&tasks->waiting, __ATOMIC_SEQ_CST)) {
+         pthread_mutex_lock(&tasks->mutex);
+         pthread_cond_broadcast(&tasks->space);
+         pthread_mutex_unlock(&tasks->mutex);
+      }
+   }
+
+   if (tasks->fd < 0)
+      return;
+
+   // With collect there is at most one pending write per collect cycle.
+   // Pairs with the exchange in collect, that happens before it looks for completed tasks.
+   if (!collect || !__atomic_exchange_n(&tasks->signaled, true, __ATOMIC_SEQ_CST))
+      write(tasks->fd, (uint64_t[]){1}, sizeof(uint64_t));
+}
+
+static bool
+claim_chunk(struct chck_tqueue_job *job, size_t *out_begin, size_t *out_end)
+{
+   assert(job && out_begin && out_end);
+
+   size_t n, next = __atomic_load_n(&job->next, __ATOMIC_RELAXED);
+   do {
+      if (next >= job->end)
+         return false;
+
+      // Guided chunking, large chunks first and smaller towards the end to balance the load.
+      const size_t left = job->end - next;
+      n = left / (2 * job->parts);
+      n = (n < job->grain ? job->grain : n);
+      n = (n > left ? left : n);
+   } while (!__atomic_compare_exchange_n(&job->next, &next, next + n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+   *out_begin = next;
+   *out_end = next + n;
+   return true;
+}
+
+static bool
+joinable(const struct chck_tqueue_job *job)
+{
+   return (job && __atomic_load_n(&job->next, __ATOMIC_RELAXED) < job->end);
+}
+
+static void*
+help(struct chck_tqueue_job *job)
+{
+   assert(job);
+
+   void *partial = NULL;
+   if (job->reduce) {
+      const size_t index = __atomic_fetch_add(&job->participants, 1, __ATOMIC_RELAXED);
+      assert(index < job->parts);
+      partial = job->partials + index * job->rsize;
+   }
+
+   bool worked = false;
+   for (size_t begin, end; claim_chunk(job, &begin, &end); worked = true) {
+      if (job->reduce) {
+         job->reduce(begin, end, partial, job->userdata);
+      } else {
+         job->fn(begin, end, job->userdata);
+      }
+   }
+
+   return (worked ? partial : NULL);
+}
+
+static void
+leave(struct chck_tasks *tasks, struct chck_tqueue_job *job, void *partial)
+{
+   assert(tasks && job);
+
+   // Must be called with mutex held.
+   if (partial)
+      job->combine(job->result, partial, job->userdata);
+
+   if (!--job->refs)
+      pthread_cond_broadcast(&tasks->joined);
+}
+
+static bool
+join(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   pthread_mutex_lock(&tasks->mutex);
+   struct chck_tqueue_job *job = tasks->job;
+
+   if (!joinable(job)) {
+      pthread_mutex_unlock(&tasks->mutex);
+      return false;
+   }
+
+   job->refs++;
+   pthread_mutex_unlock(&tasks->mutex);
+
+   void *partial = help(job);
+
+   pthread_mutex_lock(&tasks->mutex);
+   leave(tasks, job, partial);
+   pthread_mutex_unlock(&tasks->mutex);
+   return true;
+}
+
+static bool
+has_stealable(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   for (size_t i = 0; i < tasks->nlanes; ++i) {
+      struct chck_tqueue_lane *l = &tasks->lanes[i];
+      if (__atomic_load_n(&l->ws.submitted, __ATOMIC_SEQ_CST) != __atomic_load_n(&l->ws.claimed, __ATOMIC_SEQ_CST))
+         return true;
+   }
+
+   for (size_t i = 0; i < tqueue->threads.count; ++i) {
+      struct chck_tqueue_deque *d = &tqueue->threads.workers[i].deque;
+      if (__atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST) > __atomic_load_n(&d->top, __ATOMIC_SEQ_CST))
+         return true;
+   }
+
+   return false;
+}
+
+static bool
+has_tasks(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   switch (tasks->scheduler) {
+      case CHCK_TQUEUE_WORK_STEALING:
+         return has_stealable(tqueue);
+
+      case CHCK_TQUEUE_MPMC:
+         for (size_t i = 0; i < tasks->nlanes; ++i) {
+            if (ring_ready(tasks->lanes[i].ring))
+               return true;
+         }
+         return false;
+
+      case CHCK_TQUEUE_SHARED:
+         break;
+   }
+
+   return (__atomic_load_n(&tasks->tcount, __ATOMIC_RELAXED) > 0);
+}
+
+static bool
+ready(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   // Must be called with mutex held.
+   if (tasks->cancel || joinable(tasks->job))
+      return true;
+
+   return has_tasks(tqueue);
+}
+
+static void
+spin(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   // Polls without the mutex, job is only a hint as it may not be joinable anymore.
+   const size_t rounds = __atomic_load_n(&tqueue->threads.spin, __ATOMIC_RELAXED);
+   for (size_t i = 0; i < rounds; ++i) {
+      if (__atomic_load_n(&tasks->cancel, __ATOMIC_ACQUIRE) || __atomic_load_n(&tasks->job, __ATOMIC_RELAXED))
+         return;
+
+      if (has_tasks(tqueue))
+         return;
+
+      relax(i);
+   }
+}
+
+static bool
+wait_work(struct chck_tqueue_worker *worker)
+{
+   assert(worker);
+   struct chck_tqueue *tqueue = worker->tqueue;
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   // Must be called with mutex held, returns false when the worker should exit.
+   // Waking up sleeping worker costs more than polling for a while.
+   if (!ready(tqueue) && __atomic_load_n(&tqueue->threads.spin, __ATOMIC_RELAXED) > 0) {
+      __atomic_add_fetch(&tasks->spinning, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&tasks->mutex);
+      spin(tqueue);
+      pthread_mutex_lock(&tasks->mutex);
+      __atomic_sub_fetch(&tasks->spinning, 1, __ATOMIC_SEQ_CST);
+   }
+
+   // Pairs with dispatch and wake_stealer, either they see us sleeping or we see their work.
+   __atomic_add_fetch(&tasks->sleepers, 1, __ATOMIC_SEQ_CST);
+
+   int ret = 0;
+   if (!ready(tqueue)) {
+      if (tqueue->threads.idle_timeout > 0 && tqueue->threads.alive > tqueue->threads.min) {
+         struct timespec deadline;
+         deadline_after(tqueue->threads.idle_timeout, &deadline);
+         ret = pthread_cond_timedwait(&tasks->notify, &tasks->mutex, &deadline);
+      } else {
+         pthread_cond_wait(&tasks->notify, &tasks->mutex);
+      }
+   }
+
+   __atomic_sub_fetch(&tasks->sleepers, 1, __ATOMIC_SEQ_CST);
+
+   if (tasks->cancel)
+      return false;
+
+   // Idle for too long, exit unless it would leave less than min workers.
+   // We are joined when our worker is started again, or when the queue stops.
+   if (ret == ETIMEDOUT && !ready(tqueue) && tqueue->threads.alive > tqueue->threads.min) {
+      worker->state = WORKER_EXITED;
+      __atomic_sub_fetch(&tqueue->threads.alive, 1, __ATOMIC_SEQ_CST);
+      return false;
+   }
+
+   return true;
+}
+
+static void*
+on_thread(void *arg)
+{
+   assert(arg);
+   struct chck_tqueue_worker *worker = arg;
+   struct chck_tqueue *tqueue = worker->tqueue;
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   while (true) {
+      // XXX: We could use seperate lock here for dequeueing, and have own lock for insertion.
+      //      (Or use CHCK_TQUEUE_WORK_STEALING scheduler, which does not lock for dequeueing)
+      pthread_mutex_lock(&tasks->mutex);
+
+      if (!wait_work(worker))
+         break;
+
+      // Parallel jobs go first, as the calling thread is waiting for them.
+      if (joinable(tasks->job)) {
+         pthread_mutex_unlock(&tasks->mutex);
+         join(tqueue);
+         continue;
+      }
+
+      if (!tasks->tcount) {
+         pthread_mutex_unlock(&tasks->mutex);
+         continue;
+      }
+
+      // Highest lane with tasks, unless lower lanes are due their turn.
+      const bool lowest = starving(worker);
+      struct chck_tqueue_lane *lane = NULL;
+      for (size_t i = 0; i < tasks->nlanes && !lane; ++i) {
+         struct chck_tqueue_lane *l = &tasks->lanes[lowest ? i : tasks->nlanes - i - 1];
+         lane = (l->tcount > 0 ? l : NULL);
+      }
+
+      // Take fair share of the pending tasks, rest is left for others.
+      assert(lane && lane->tcount > 0);
+      size_t n = lane->tcount / tqueue->threads.alive + 1;
+      n = (n > lane->tcount ? lane->tcount : n);
+      n = (n > DEQUEUE_BATCH ? DEQUEUE_BATCH : n);
+
+      // Queue positions may be reused once dispatched, so copy the slots out.
+      size_t slots[DEQUEUE_BATCH];
+      for (size_t i = 0; i < n; ++i)
+         slots[i] = lane->queue[(lane->thead + i) % tasks->qsize];
+
+      assert(tasks->qsize > 0);
+      lane->thead = (lane->thead + n) % tasks->qsize;
+      lane->tcount -= n;
+      __atomic_sub_fetch(&tasks->tcount, n, __ATOMIC_RELAXED);
+
+      pthread_mutex_unlock(&tasks->mutex);
+
+      for (size_t i = 0; i < n; ++i)
+         run(worker, slots[i]);
+   }
+
+   pthread_mutex_unlock(&tasks->mutex);
+   return NULL;
+}
+
+static void
+wake_stealer(struct chck_tasks *tasks)
+{
+   assert(tasks);
+
+   // Pairs with the increment in park, either we see the sleeper or it sees our work.
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+   if (!__atomic_load_n(&tasks->sleepers, __ATOMIC_SEQ_CST))
+      return;
+
+   pthread_mutex_lock(&tasks->mutex);
+   pthread_cond_signal(&tasks->notify);
+   pthread_mutex_unlock(&tasks->mutex);
+}
+
+static bool
+claim(struct chck_tqueue_worker *worker, size_t index, size_t *out_slot)
+{
+   assert(worker && out_slot);
+   struct chck_tasks *tasks = &worker->tqueue->tasks;
+   struct chck_tqueue_lane *lane = &tasks->lanes[index];
+   const size_t nthreads = __atomic_load_n(&worker->tqueue->threads.alive, __ATOMIC_SEQ_CST);
+   assert(nthreads > 0);
+
+   // Higher lanes may be claimed before the deque is drained, so claim only as much as it has space for.
+   // Top only moves forward, so stale top only makes us claim less.
+   const int64_t used = __atomic_load_n(&worker->deque.bottom, __ATOMIC_RELAXED) - __atomic_load_n(&worker->deque.top, __ATOMIC_ACQUIRE);
+   const size_t space = (used < DEQUE_SIZE ? DEQUE_SIZE - used : 0) + 1;
+
+   size_t slots[DEQUE_SIZE + 1], n;
+   size_t claimed = __atomic_load_n(&lane->ws.claimed, __ATOMIC_RELAXED);
+   do {
+      const size_t avail = __atomic_load_n(&lane->ws.submitted, __ATOMIC_ACQUIRE) - claimed;
+
+      if (!avail)
+         return false;
+
+      // Take fair share of the pending tasks, rest is left for others to claim.
+      n = avail / nthreads + 1;
+      n = (n > avail ? avail : n);
+      n = (n > space ? space : n);
+
+      // Read slots before claiming, claimed positions may be reused by producers right away.
+      // If someone else claimed them meanwhile, the CAS fails and we read again.
+      for (size_t i = 0; i < n; ++i)
+         slots[i] = __atomic_load_n(&lane->queue[(claimed + i) % tasks->qsize], __ATOMIC_RELAXED);
+   } while (!__atomic_compare_exchange_n(&lane->ws.claimed, &claimed, claimed + n, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+   *out_slot = slots[0];
+
+   for (size_t i = 1; i < n; ++i) {
+      const bool pushed = deque_push(&worker->deque, slots[i]);
+      assert(pushed); (void)pushed;
+   }
+
+   if (n > 1) {
+      worker->lane = index;
+      wake_stealer(tasks);
+   }
+
+   return true;
+}
+
+static bool
+claim_lanes(struct chck_tqueue_worker *worker, size_t from, bool lowest, size_t *out_slot)
+{
+   assert(worker && out_slot);
+   const size_t nlanes = worker->tqueue->tasks.nlanes;
+
+   for (size_t i = from; i < nlanes; ++i) {
+      if (claim(worker, (lowest ? i : nlanes - i - 1 + from), out_slot))
+         return true;
+   }
+
+   return false;
+}
+
+static bool
+steal(struct chck_tqueue_worker *worker, size_t *out_slot)
+{
+   assert(worker && out_slot);
+   struct chck_tqueue *tqueue = worker->tqueue;
+   const size_t self = worker - tqueue->threads.workers;
+   const size_t nthreads = tqueue->threads.count;
+
+   bool retry;
+   do {
+      retry = false;
+      for (size_t i = 1; i < nthreads; ++i) {
+         switch (deque_steal(&tqueue->threads.workers[(self + i) % nthreads].deque, out_slot)) {
+            case STEAL_OK:
+               return true;
+            case STEAL_ABORT:
+               retry = true;
+               break;
+            case STEAL_EMPTY:
+               break;
+         }
+      }
+   } while (retry);
+
+   return false;
+}
+
+static bool
+park(struct chck_tqueue_worker *worker)
+{
+   assert(worker);
+   struct chck_tasks *tasks = &worker->tqueue->tasks;
+
+   pthread_mutex_lock(&tasks->mutex);
+   const bool alive = wait_work(worker);
+   pthread_mutex_unlock(&tasks->mutex);
+   return alive;
+}
+
+static void*
+on_thread_stealing(void *arg)
+{
+   assert(arg);
+   struct chck_tqueue_worker *worker = arg;
+   struct chck_tasks *tasks = &worker->tqueue->tasks;
+
+   while (!__atomic_load_n(&tasks->cancel, __ATOMIC_ACQUIRE)) {
+      // Parallel jobs go first, as the calling thread is waiting for them.
+      if (__atomic_load_n(&tasks->job, __ATOMIC_RELAXED) && join(worker->tqueue))
+         continue;
+
+      // Lanes above what we have claimed go first, unless lower lanes are due their turn.
+      const bool lowest = starving(worker);
+
+      size_t slot;
+      if ((!lowest && claim_lanes(worker, worker->lane + 1, false, &slot)) ||
+          deque_take(&worker->deque, &slot) ||
+          claim_lanes(worker, 0, lowest, &slot) ||
+          steal(worker, &slot)) {
+         run(worker, slot);
+         continue;
+      }
+
+      if (!park(worker))
+         break;
+   }
+
+   return NULL;
+}
+
+static bool
+take_ring(struct chck_tqueue_worker *worker, size_t *out_slot)
+{
+   assert(worker && out_slot);
+   struct chck_tasks *tasks = &worker->tqueue->tasks;
+
+   // Highest lane with tasks, unless lower lanes are due their turn.
+   const bool lowest = starving(worker);
+   for (size_t i = 0; i < tasks->nlanes; ++i) {
+      if (ring_pop(tasks->lanes[lowest ? i : tasks->nlanes - i - 1].ring, out_slot))
+         return true;
+   }
+
+   return false;
+}
+
+static void*
+on_thread_ring(void *arg)
+{
+   assert(arg);
+   struct chck_tqueue_worker *worker = arg;
+   struct chck_tasks *tasks = &worker->tqueue->tasks;
+
+   while (!__atomic_load_n(&tasks->cancel, __ATOMIC_ACQUIRE)) {
+      // Parallel jobs go first, as the calling thread is waiting for them.
+      if (__atomic_load_n(&tasks->job, __ATOMIC_RELAXED) && join(worker->tqueue))
+         continue;
+
+      size_t slot;
+      if (take_ring(worker, &slot)) {
+         run(worker, slot);
+         continue;
+      }
+
+      if (!park(worker))
+         break;
+   }
+
+   return NULL;
+}
+
+static void
+stop(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   if (!__atomic_load_n(&tqueue->threads.running, __ATOMIC_ACQUIRE))
+      return;
+
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+   __atomic_store_n(&tqueue->tasks.cancel, true, __ATOMIC_RELEASE);
+   pthread_cond_broadcast(&tqueue->tasks.notify);
+   pthread_cond_broadcast(&tqueue->tasks.space);
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+
+   // Workers won't start or exit on their own after cancel, so their states stay put.
+   for (size_t i = 0; i < tqueue->threads.count; ++i) {
+      struct chck_tqueue_worker *w = &tqueue->threads.workers[i];
+
+      if (w->state != WORKER_STOPPED)
+         pthread_join(tqueue->threads.t[i], NULL);
+
+      w->state = WORKER_STOPPED;
+   }
+
+   memset(tqueue->threads.t, 0, sizeof(*tqueue->threads.t) * tqueue->threads.count);
+   tqueue->threads.alive = 0;
+   __atomic_store_n(&tqueue->threads.running, false, __ATOMIC_RELEASE);
+}
+
+static bool
+set_attr(struct chck_tqueue *tqueue, pthread_attr_t *attr)
+{
+   assert(tqueue && attr);
+
+   if (tqueue->threads.options.stack_size > 0 && pthread_attr_setstacksize(attr, tqueue->threads.options.stack_size) != 0)
+      return false;
+
+   if (tqueue->threads.options.policy != SCHED_OTHER) {
+      const struct sched_param param = { .sched_priority = tqueue->threads.options.priority };
+      if (pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED) != 0 ||
+          pthread_attr_setschedpolicy(attr, tqueue->threads.options.policy) != 0 ||
+          pthread_attr_setschedparam(attr, &param) != 0)
+         return false;
+   }
+
+   return true;
+}
+
+static bool
+set_affinity(struct chck_tqueue *tqueue, pthread_attr_t *attr, size_t index)
+{
+   assert(tqueue && attr);
+
+#ifdef __linux__
+   if (!tqueue->threads.options.ncpus)
+      return true;
+
+   cpu_set_t set;
+   CPU_ZERO(&set);
+
+   if (tqueue->threads.options.spread) {
+      CPU_SET(tqueue->threads.options.cpus[index % tqueue->threads.options.ncpus], &set);
+   } else {
+      for (size_t i = 0; i < tqueue->threads.options.ncpus; ++i)
+         CPU_SET(tqueue->threads.options.cpus[i], &set);
+   }
+
+   return (pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0);
+#else
+   (void)index;
+   return true;
+#endif
+}
+
+static void
+set_name(struct chck_tqueue *tqueue, pthread_t thread, size_t index)
+{
+   assert(tqueue);
+
+#ifdef __linux__
+   if (!*tqueue->threads.options.name)
+      return;
+
+   // Truncate the prefix rather than index, kernel allows 15 characters.
+   char suffix[24], name[16];
+   const size_t slen = snprintf(suffix, sizeof(suffix), "/%zu", index);
+   const size_t plen = strnlen(tqueue->threads.options.name, sizeof(name) - 1 - slen);
+   memcpy(name, tqueue->threads.options.name, plen);
+   memcpy(name + plen, suffix, slen + 1);
+   pthread_setname_np(thread, name);
+#else
+   (void)thread, (void)index;
+#endif
+}
+
+static bool
+spawn(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   // Must be called with mutex held, starts the first worker that is not running.
+   size_t i;
+   for (i = 0; i < tqueue->threads.count && tqueue->threads.workers[i].state == WORKER_RUNNING; ++i);
+
+   if (i >= tqueue->threads.count)
+      return false;
+
+   // Worker that exited on idle won't touch the mutex anymore, so this doesn't block for long.
+   struct chck_tqueue_worker *worker = &tqueue->threads.workers[i];
+   if (worker->state == WORKER_EXITED)
+      pthread_join(tqueue->threads.t[i], NULL);
+
+   worker->state = WORKER_STOPPED;
+
+   pthread_attr_t attr;
+   if (pthread_attr_init(&attr) != 0)
+      return false;
+
+   // Counted before it runs, work stealing workers read alive without the mutex.
+   __atomic_add_fetch(&tqueue->threads.alive, 1, __ATOMIC_SEQ_CST);
+
+   void* (*function)(void*) = on_thread;
+   if (tqueue->tasks.scheduler == CHCK_TQUEUE_WORK_STEALING) {
+      function = on_thread_stealing;
+   } else if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC) {
+      function = on_thread_ring;
+   }
+
+   const bool created = (set_attr(tqueue, &attr) && set_affinity(tqueue, &attr, i) &&
+                         pthread_create(&tqueue->threads.t[i], &attr, function, worker) == 0);
+   pthread_attr_destroy(&attr);
+
+   if (!created) {
+      __atomic_sub_fetch(&tqueue->threads.alive, 1, __ATOMIC_SEQ_CST);
+      return false;
+   }
+
+   set_name(tqueue, tqueue->threads.t[i], i);
+   worker->state = WORKER_RUNNING;
+   return true;
+}
+
+static bool
+start(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   if (__atomic_load_n(&tqueue->threads.running, __ATOMIC_ACQUIRE))
+      return true;
+
+   // With MPMC scheduler any thread may be the first to add tasks.
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+
+   if (__atomic_load_n(&tqueue->threads.running, __ATOMIC_ACQUIRE)) {
+      pthread_mutex_unlock(&tqueue->tasks.mutex);
+      return true;
+   }
+
+   __atomic_store_n(&tqueue->tasks.cancel, false, __ATOMIC_RELAXED);
+
+   // Rest of the workers are started when there are more tasks than idle workers.
+   bool started = true;
+   while (started && tqueue->threads.alive < tqueue->threads.min)
+      started = spawn(tqueue);
+
+   __atomic_store_n(&tqueue->threads.running, true, __ATOMIC_RELEASE);
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+
+   if (!started) {
+      // Don't leave partial set of workers running.
+      stop(tqueue);
+      return false;
+   }
+
+   return true;
+}
+
+static size_t
+allocate(struct chck_tasks *tasks, size_t index, const uint8_t *item)
+{
+   assert(tasks && tasks->nunused > 0);
+
+   // Must be called with mutex held, item is NULL when emplacing.
+   const size_t slot = tasks->unused[--tasks->nunused];
+
+   if (item)
+      memcpy(get_data(tasks, slot), item, tasks->lanes[index].msize);
+
+   tasks->owners[slot] = index;
+
+   if (tasks->nodes) {
+      tasks->nodes[slot].state = NODE_QUEUED;
+      tasks->nodes[slot].pending = 1;
+      __atomic_store_n(&tasks->nodes[slot].head, EDGE_NONE, __ATOMIC_RELAXED);
+   }
+
+   return slot;
+}
+
+static size_t
+enqueue(struct chck_tqueue *tqueue, size_t index, const uint8_t *items, size_t memb)
+{
+   assert(tqueue && items);
+   struct chck_tasks *tasks = &tqueue->tasks;
+   struct chck_tqueue_lane *lane = &tasks->lanes[index];
+
+   const size_t n = (memb < tasks->nunused ? memb : tasks->nunused);
+
+   // Rest of the slot past lane's msize is not used by the lane.
+   for (size_t i = 0; i < n; ++i) {
+      const size_t slot = allocate(tasks, index, items + i * lane->msize);
+      __atomic_store_n(&lane->queue[(lane->tail + i) % tasks->qsize], slot, __ATOMIC_RELAXED);
+   }
+
+   tasks->count += n;
+   dispatch(tqueue, index, n);
+   return n;
+}
+
+static bool
+link_dependency(struct chck_tasks *tasks, size_t slot, size_t edge, const struct chck_tqueue_task *dep)
+{
+   assert(tasks && dep);
+
+   // Must be called with mutex held, so the dependency can't be retired meanwhile.
+   if (dep->slot >= tasks->qsize || tasks->nodes[dep->slot].generation != dep->generation)
+      return false;
+
+   __atomic_add_fetch(&tasks->nodes[slot].pending, 1, __ATOMIC_RELAXED);
+
+   struct chck_tqueue_node *node = &tasks->nodes[dep->slot];
+   size_t head = __atomic_load_n(&node->head, __ATOMIC_ACQUIRE);
+   do {
+      if (head == EDGE_CLOSED) {
+         __atomic_sub_fetch(&tasks->nodes[slot].pending, 1, __ATOMIC_RELAXED);
+         return false;
+      }
+
+      tasks->edges[edge] = head;
+   } while (!__atomic_compare_exchange_n(&node->head, &head, edge, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+   return true;
+}
+
+static size_t
+enqueue_after(struct chck_tqueue *tqueue, size_t index, const uint8_t *item, const struct chck_tqueue_task *deps, size_t ndeps, struct chck_tqueue_task *out_task)
+{
+   assert(tqueue && item && (deps || !ndeps) && ndeps <= CHCK_TQUEUE_MAX_DEPS && out_task);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   if (!tasks->nunused)
+      return 0;
+
+   const size_t slot = allocate(tasks, index, item);
+   tasks->count++;
+
+   for (size_t i = 0; i < ndeps; ++i)
+      link_dependency(tasks, slot, slot * CHCK_TQUEUE_MAX_DEPS + i, &deps[i]);
+
+   *out_task = (struct chck_tqueue_task){ .slot = slot, .generation = tasks->nodes[slot].generation };
+
+   // Dependencies may have finished already, and then we are ready ourselves.
+   if (!__atomic_sub_fetch(&tasks->nodes[slot].pending, 1, __ATOMIC_ACQ_REL))
+      publish(tqueue, slot);
+
+   return 1;
+}
+
+static bool
+wait_space(struct chck_tqueue *tqueue, const struct timespec *deadline, bool collector)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   // Workers check this after completing a task, so either we see the completion or they see us.
+   __atomic_add_fetch(&tasks->waiting, 1, __ATOMIC_SEQ_CST);
+
+   // Collector makes space itself, so it only waits until there is something to collect.
+   int ret = 0;
+   if (tasks->count >= tasks->qsize && !tasks->cancel && !(collector && collectable(tqueue))) {
+      if (deadline) {
+         ret = pthread_cond_timedwait(&tasks->space, &tasks->mutex, deadline);
+      } else {
+         ret = pthread_cond_wait(&tasks->space, &tasks->mutex);
+      }
+   }
+
+   __atomic_sub_fetch(&tasks->waiting, 1, __ATOMIC_SEQ_CST);
+   return (ret != ETIMEDOUT);
+}
+
+static bool
+can_collect(const struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   // Full queue may be held by completed tasks of any lane, not just the one being added to.
+   return (tqueue->threads.self == pthread_self() &&
+          (has_callback(&tqueue->tasks) || __atomic_load_n(&tqueue->tasks.continuations, __ATOMIC_ACQUIRE)));
+}
+
+static bool
+reserve(struct chck_tqueue *tqueue, bool collector, bool block, const struct timespec *deadline)
+{
+   assert(tqueue);
+
+   // Returns with mutex held, when there is space for at least one task.
+   while (true) {
+      // Collecting while blocked may stop the workers when they run out of tasks.
+      if (!__atomic_load_n(&tqueue->threads.running, __ATOMIC_ACQUIRE) && !start(tqueue))
+         return false;
+
+      pthread_mutex_lock(&tqueue->tasks.mutex);
+
+      if (tqueue->tasks.count >= tqueue->tasks.qsize) {
+         stats_full(&tqueue->tasks, block);
+         pthread_mutex_unlock(&tqueue->tasks.mutex);
+
+         if (!block)
+            return false;
+
+         if (collector && chck_tqueue_collect(tqueue) < tqueue->tasks.qsize)
+            continue;
+
+         pthread_mutex_lock(&tqueue->tasks.mutex);
+         const bool waited = wait_space(tqueue, deadline, collector);
+         pthread_mutex_unlock(&tqueue->tasks.mutex);
+
+         if (!waited)
+            return false;
+
+         continue;
+      }
+
+      if (tqueue->tasks.cancel) {
+         pthread_mutex_unlock(&tqueue->tasks.mutex);
+         return false;
+      }
+
+      return true;
+   }
+}
+
+static size_t collect_ring(struct chck_tqueue *tqueue);
+
+static bool
+reserve_ring(struct chck_tqueue *tqueue, bool block, const struct timespec *deadline, size_t *out_slot)
+{
+   assert(tqueue && out_slot);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   while (!ring_pop(tasks->available, out_slot)) {
+      stats_full(tasks, block);
+
+      if (!block)
+         return false;
+
+      // Any thread may collect, so producer makes space itself when it can.
+      if (ring_ready(tasks->completed)) {
+         collect_ring(tqueue);
+         continue;
+      }
+
+      pthread_mutex_lock(&tasks->mutex);
+      __atomic_add_fetch(&tasks->waiting, 1, __ATOMIC_SEQ_CST);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+      int ret = 0;
+      if (!tasks->cancel && !ring_ready(tasks->available) && !ring_ready(tasks->completed)) {
+         if (deadline) {
+            ret = pthread_cond_timedwait(&tasks->space, &tasks->mutex, deadline);
+         } else {
+            ret = pthread_cond_wait(&tasks->space, &tasks->mutex);
+         }
+      }
+
+      __atomic_sub_fetch(&tasks->waiting, 1, __ATOMIC_SEQ_CST);
+      const bool cancel = tasks->cancel;
+      pthread_mutex_unlock(&tasks->mutex);
+
+      if (cancel || ret == ETIMEDOUT)
+         return false;
+   }
+
+   __atomic_add_fetch(&tasks->count, 1, __ATOMIC_SEQ_CST);
+   return true;
+}
+
+static void
+submit_ring(struct chck_tqueue *tqueue, size_t slot)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   stats_submit(tasks, slot);
+   ring_put(get_lane(tasks, slot)->ring, slot);
+
+   // Pairs with wait_work, either we see the sleeper or it sees the task.
+   // The mutex is needed only to wake someone up, or to start more workers.
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   const size_t sleepers = __atomic_load_n(&tasks->sleepers, __ATOMIC_SEQ_CST);
+   if (!sleepers && __atomic_load_n(&tqueue->threads.alive, __ATOMIC_SEQ_CST) >= tqueue->threads.count)
+      return;
+
+   size_t pending = 0;
+   for (size_t i = 0; i < tasks->nlanes; ++i)
+      pending += ring_pending(tasks->lanes[i].ring);
+
+   pthread_mutex_lock(&tasks->mutex);
+   grow(tqueue, pending);
+   wake_workers(tqueue, __atomic_load_n(&tasks->sleepers, __ATOMIC_SEQ_CST), 1);
+   pthread_mutex_unlock(&tasks->mutex);
+}
+
+static size_t
+add_ring(struct chck_tqueue *tqueue, size_t lane, const uint8_t *items, size_t memb, bool block, const struct timespec *deadline)
+{
+   assert(tqueue && (items || !memb));
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   if (!start(tqueue))
+      return 0;
+
+   // Data is copied without any lock, the slot is ours until it is submitted.
+   size_t added, slot;
+   const size_t msize = tasks->lanes[lane].msize;
+   for (added = 0; added < memb && reserve_ring(tqueue, block, deadline, &slot); ++added) {
+      memcpy(get_data(tasks, slot), items + added * msize, msize);
+      tasks->owners[slot] = lane;
+      submit_ring(tqueue, slot);
+   }
+
+   return added;
+}
+
+static size_t
+add_tasks(struct chck_tqueue *tqueue, size_t lane, const void *items, size_t memb, bool block, const struct timespec *deadline, const struct chck_tqueue_task *deps, size_t ndeps, struct chck_tqueue_task *out_task)
+{
+   assert(tqueue && (items || !memb));
+   assert(tqueue->tasks.qsize > 0);
+
+   if (lane >= tqueue->tasks.nlanes)
+      return 0;
+
+   if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC)
+      return (out_task ? 0 : add_ring(tqueue, lane, items, memb, block, deadline));
+
+   const size_t msize = tqueue->tasks.lanes[lane].msize;
+   const bool collector = can_collect(tqueue);
+
+   size_t added = 0;
+   while (added < memb && reserve(tqueue, collector, block, deadline)) {
+      // Whole batch goes in under single lock, as much as there is space for.
+      if (out_task) {
+         added += enqueue_after(tqueue, lane, (const uint8_t*)items + added * msize, deps, ndeps, out_task);
+      } else {
+         added += enqueue(tqueue, lane, (const uint8_t*)items + added * msize, memb - added);
+      }
+      pthread_mutex_unlock(&tqueue->tasks.mutex);
+   }
+
+   return added;
+}
+
+size_t
+chck_tqueue_add_lane_tasks(struct chck_tqueue *tqueue, size_t lane, const void *items, size_t memb, useconds_t block)
+{
+   assert(tqueue);
+   return add_tasks(tqueue, lane, items, memb, block, NULL, NULL, 0, NULL);
+}
+
+bool
+chck_tqueue_add_lane_task(struct chck_tqueue *tqueue, size_t lane, void *data, useconds_t block)
+{
+   assert(tqueue && data);
+   return (add_tasks(tqueue, lane, data, 1, block, NULL, NULL, 0, NULL) == 1);
+}
+
+size_t
+chck_tqueue_add_tasks(struct chck_tqueue *tqueue, const void *items, size_t memb, useconds_t block)
+{
+   assert(tqueue);
+   return add_tasks(tqueue, 0, items, memb, block, NULL, NULL, 0, NULL);
+}
+
+bool
+chck_tqueue_add_task(struct chck_tqueue *tqueue, void *data, useconds_t block)
+{
+   assert(tqueue && data);
+   return (add_tasks(tqueue, 0, data, 1, block, NULL, NULL, 0, NULL) == 1);
+}
+
+static bool
+prepare_graph(struct chck_tasks *tasks)
+{
+   assert(tasks);
+
+   pthread_mutex_lock(&tasks->mutex);
+
+   if (tasks->nodes) {
+      pthread_mutex_unlock(&tasks->mutex);
+      return true;
+   }
+
+   struct chck_tqueue_node *nodes;
+   if (!(nodes = chck_calloc_of(tasks->qsize, sizeof(struct chck_tqueue_node))) ||
+       !(tasks->edges = chck_calloc_of(tasks->qsize, CHCK_TQUEUE_MAX_DEPS * sizeof(size_t)))) {
+      free(nodes);
+      pthread_mutex_unlock(&tasks->mutex);
+      return false;
+   }
+
+   // Tasks already in flight were added without graph, nobody can depend on them.
+   for (size_t i = 0; i < tasks->qsize; ++i)
+      nodes[i].head = EDGE_CLOSED;
+
+   __atomic_store_n(&tasks->nodes, nodes, __ATOMIC_RELEASE);
+   pthread_mutex_unlock(&tasks->mutex);
+   return true;
+}
+
+bool
+chck_tqueue_add_lane_task_after(struct chck_tqueue *tqueue, size_t lane, void *data, const struct chck_tqueue_task *deps, size_t ndeps, useconds_t block, struct chck_tqueue_task *out_task)
+{
+   assert(tqueue && data && (deps || !ndeps) && out_task);
+
+   if (!data || (!deps && ndeps > 0) || ndeps > CHCK_TQUEUE_MAX_DEPS || !out_task || !prepare_graph(&tqueue->tasks))
+      return false;
+
+   return (add_tasks(tqueue, lane, data, 1, block, NULL, deps, ndeps, out_task) == 1);
+}
+
+bool
+chck_tqueue_then(struct chck_tqueue *tqueue, const struct chck_tqueue_task *task, size_t lane, void *data, useconds_t block, struct chck_tqueue_task *out_task)
+{
+   assert(tqueue && task);
+   return chck_tqueue_add_lane_task_after(tqueue, lane, data, task, 1, block, out_task);
+}
+
+bool
+chck_tqueue_task_done(struct chck_tqueue *tqueue, const struct chck_tqueue_task *task)
+{
+   assert(tqueue && task);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   if (task->slot >= tasks->qsize)
+      return true;
+
+   // Handles only come from tasks with graph, so no graph means invalid handle.
+   pthread_mutex_lock(&tasks->mutex);
+   const bool done = (!tasks->nodes || tasks->nodes[task->slot].generation != task->generation || __atomic_load_n(&tasks->nodes[task->slot].head, __ATOMIC_ACQUIRE) == EDGE_CLOSED);
+   pthread_mutex_unlock(&tasks->mutex);
+   return done;
+}
+
+static bool
+prepare_continuations(struct chck_tasks *tasks)
+{
+   assert(tasks);
+
+   pthread_mutex_lock(&tasks->mutex);
+
+   struct chck_tqueue_continuation *continuations = NULL;
+   if (!tasks->continuations && (continuations = chck_calloc_of(tasks->qsize, sizeof(struct chck_tqueue_continuation))))
+      __atomic_store_n(&tasks->continuations, continuations, __ATOMIC_RELEASE);
+
+   const bool prepared = (tasks->continuations != NULL);
+   pthread_mutex_unlock(&tasks->mutex);
+   return prepared;
+}
+
+bool
+chck_tqueue_add_lane_task_async(struct chck_tqueue *tqueue, size_t lane, void *data, useconds_t block, const struct chck_tqueue_continuation *continuation, struct chck_tqueue_task *out_task)
+{
+   assert(tqueue && data && continuation && continuation->resume);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   if (lane >= tasks->nlanes || !continuation->resume || tasks->scheduler == CHCK_TQUEUE_MPMC)
+      return false;
+
+   // Handles and cancellation need the graph.
+   if (!prepare_graph(tasks) || !prepare_continuations(tasks))
+      return false;
+
+   // Continuations run from collect, so creator thread makes space itself even if lane has no callback.
+   if (!reserve(tqueue, tqueue->threads.self == pthread_self(), block, NULL))
+      return false;
+
+   const size_t slot = allocate(tasks, lane, data);
+   tasks->continuations[slot] = *continuation;
+   tasks->count++;
+
+   if (out_task)
+      *out_task = (struct chck_tqueue_task){ .slot = slot, .generation = tasks->nodes[slot].generation };
+
+   publish(tqueue, slot);
+   pthread_mutex_unlock(&tasks->mutex);
+   return true;
+}
+
+bool
+chck_tqueue_cancel_task(struct chck_tqueue *tqueue, const struct chck_tqueue_task *task)
+{
+   assert(tqueue && task);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   if (task->slot >= tasks->qsize || tasks->scheduler == CHCK_TQUEUE_MPMC)
+      return false;
+
+   // Slot can't be retired and reused while we hold the mutex.
+   pthread_mutex_lock(&tasks->mutex);
+   enum node_state queued = NODE_QUEUED;
+   struct chck_tqueue_node *node = (tasks->nodes ? &tasks->nodes[task->slot] : NULL);
+   const bool cancelled = (node && node->generation == task->generation &&
+                           __atomic_compare_exchange_n(&node->state, &queued, NODE_CANCELLED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+   pthread_mutex_unlock(&tasks->mutex);
+   return cancelled;
+}
+
+static bool
+get_emplaced_slot(struct chck_tasks *tasks, const void *data, size_t *out_slot)
+{
+   assert(tasks && out_slot);
+
+   const uint8_t *ptr = data;
+   if (!ptr || ptr < tasks->buffer || ptr >= tasks->buffer + tasks->qsize * tasks->msize || (ptr - tasks->buffer) % tasks->msize)
+      return false;
+
+   // only one commit or discard takes the slot out of emplaced state
+   const size_t slot = (ptr - tasks->buffer) / tasks->msize;
+   if (!__atomic_exchange_n(&tasks->emplaced[slot], false, __ATOMIC_ACQ_REL))
+      return false;
+
+   *out_slot = slot;
+   return true;
+}
+
+void*
+chck_tqueue_emplace_lane_task(struct chck_tqueue *tqueue, size_t lane, useconds_t block)
+{
+   assert(tqueue);
+
+   if (lane >= tqueue->tasks.nlanes)
+      return NULL;
+
+   if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC) {
+      size_t slot;
+      if (!start(tqueue) || !reserve_ring(tqueue, block, NULL, &slot))
+         return NULL;
+
+      tqueue->tasks.owners[slot] = lane;
+      __atomic_store_n(&tqueue->tasks.emplaced[slot], true, __ATOMIC_RELEASE);
+      return get_data(&tqueue->tasks, slot);
+   }
+
+   const bool collector = can_collect(tqueue);
+
+   if (!reserve(tqueue, collector, block, NULL))
+      return NULL;
+
+   const size_t slot = allocate(&tqueue->tasks, lane, NULL);
+   tqueue->tasks.count++;
+   __atomic_store_n(&tqueue->tasks.emplaced[slot], true, __ATOMIC_RELEASE);
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+   return get_data(&tqueue->tasks, slot);
+}
+
+void*
+chck_tqueue_emplace_task(struct chck_tqueue *tqueue, useconds_t block)
+{
+   assert(tqueue);
+   return chck_tqueue_emplace_lane_task(tqueue, 0, block);
+}
+
+bool
+chck_tqueue_commit_task(struct chck_tqueue *tqueue, void *data)
+{
+   assert(tqueue && data);
+
+   size_t slot;
+   if (!get_emplaced_slot(&tqueue->tasks, data, &slot))
+      return false;
+
+   if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC) {
+      submit_ring(tqueue, slot);
+      return true;
+   }
+
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+   publish(tqueue, slot);
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+   return true;
+}
+
+bool
+chck_tqueue_discard_task(struct chck_tqueue *tqueue, void *data)
+{
+   assert(tqueue && data);
+
+   size_t slot;
+   if (!get_emplaced_slot(&tqueue->tasks, data, &slot))
+      return false;
+
+   if (tqueue->tasks.zero)
+      memset(data, 0, tqueue->tasks.msize);
+
+   if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC) {
+      release_ring_slot(&tqueue->tasks, slot);
+      return true;
+   }
+
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+   release_slots(&tqueue->tasks, &slot, 1);
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+   return true;
+}
+
+bool
+chck_tqueue_add_task_timed(struct chck_tqueue *tqueue, void *data, uint64_t timeout_ns)
+{
+   assert(tqueue && data);
+
+   struct timespec deadline;
+   deadline_after(timeout_ns, &deadline);
+   return (add_tasks(tqueue, 0, data, 1, true, &deadline, NULL, 0, NULL) == 1);
+}
+
+static void
+finish(struct chck_tasks *tasks, size_t slot)
+{
+   assert(tasks);
+   struct chck_tqueue_lane *lane = get_lane(tasks, slot);
+   void *data = get_data(tasks, slot);
+   VALGRIND_HG_DISABLE_CHECKING(data, tasks->msize);
+   stats_collect(tasks, slot);
+
+   const bool cancelled = (tasks->nodes && tasks->scheduler != CHCK_TQUEUE_MPMC && tasks->nodes[slot].state == NODE_CANCELLED);
+
+   if (lane->callback && !cancelled)
+      lane->callback(data);
+
+   // Continuation may read the results before destructor.
+   if (tasks->continuations && tasks->continuations[slot].resume) {
+      const struct chck_tqueue_continuation continuation = tasks->continuations[slot];
+      tasks->continuations[slot].resume = NULL;
+      continuation.resume(data, cancelled, continuation.userdata);
+   }
+
+   if (lane->destructor)
+      lane->destructor(data);
+
+   if (tasks->zero)
+      memset(data, 0, tasks->msize);
+
+   VALGRIND_HG_ENABLE_CHECKING(data, tasks->msize);
+}
+
+static size_t
+collect_ring(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   // Every completed slot is popped by exactly one collector.
+   // Stop after qsize, so busy workers can't keep us here forever.
+   size_t slot;
+   for (size_t i = 0; i < tasks->qsize && ring_pop(tasks->completed, &slot); ++i) {
+      finish(tasks, slot);
+      release_ring_slot(tasks, slot);
+   }
+
+   // Workers keep running, other threads may be about to add tasks.
+   return __atomic_load_n(&tasks->count, __ATOMIC_SEQ_CST);
+}
+
+size_t
+chck_tqueue_collect(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   // Collect is unneccessary when no callback specified, and no async tasks are added
+   assert(has_callback(&tqueue->tasks) || tqueue->tasks.continuations);
+
+   // For simplicity, we only allow collection on creator thread, unless MPMC scheduler is used.
+   if (!tqueue || (tqueue->tasks.scheduler != CHCK_TQUEUE_MPMC && !creator_thread(tqueue)))
+      return 0;
+
+   // Worker that completes a task after this writes again, so no completion goes unnoticed.
+   // Our own eventfd is non-blocking, and read always, as the write may still be on its way.
+   const bool signaled = __atomic_exchange_n(&tqueue->tasks.signaled, false, __ATOMIC_SEQ_CST);
+   if (tqueue->tasks.fd >= 0 && (signaled || tqueue->tasks.fd_owned)) {
+      char buf[sizeof(uint64_t)];
+      read(tqueue->tasks.fd, buf, sizeof(buf));
+   }
+
+   if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC)
+      return collect_ring(tqueue);
+
+   struct chck_tasks *tasks = &tqueue->tasks;
+   const bool in_order = (tasks->order == CHCK_TQUEUE_SUBMISSION_ORDER);
+
+   // Only the completed tasks are visited, workers hand them over through their own rings.
+   size_t retired = 0;
+   for (size_t i = 0; i < tqueue->threads.count; ++i) {
+      struct chck_tqueue_worker *w = &tqueue->threads.workers[i];
+      const size_t tail = __atomic_load_n(&w->done.tail, __ATOMIC_ACQUIRE);
+
+      for (; w->done.head != tail; ++w->done.head) {
+         const size_t slot = w->done.slots[w->done.head % tasks->qsize];
+
+         if (in_order) {
+            tasks->processed[slot] = true;
+         } else {
+            finish(tasks, slot);
+            tasks->retired[retired++] = slot;
+         }
+      }
+   }
+
+   // In submission order, completed tasks wait until the ones before them in the same lane are done.
+   // Queue position past the newest task refers to a slot that is either unused, or in use by another lane.
+   // Thus we don't need to compare against tail, which is ambiguous when the queue is full.
+   for (size_t i = 0; in_order && i < tasks->nlanes; ++i) {
+      struct chck_tqueue_lane *lane = &tasks->lanes[i];
+      for (size_t slot; (slot = __atomic_load_n(&lane->queue[lane->head], __ATOMIC_RELAXED), tasks->processed[slot] && tasks->owners[slot] == i); lane->head = (lane->head + 1) % tasks->qsize) {
+         tasks->processed[slot] = false;
+         finish(tasks, slot);
+         tasks->retired[retired++] = slot;
+      }
+   }
+
+   // We need to lock here however
+   pthread_mutex_lock(&tasks->mutex);
+   release_slots(tasks, tasks->retired, retired);
+   const size_t rcount = tasks->count;
+   pthread_mutex_unlock(&tasks->mutex);
+
+   if (!tqueue->threads.keep_alive && !rcount)
+      stop(tqueue);
+
+   return rcount;
+}
+
+#if HAS_TQUEUE_STATS
+static void
+copy_histogram(struct chck_tqueue_histogram *dst, const struct chck_tqueue_histogram *src)
+{
+   assert(dst && src);
+   dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+   dst->sum_ns = __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+   dst->max_ns = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+
+   for (size_t i = 0; i < CHCK_TQUEUE_HISTOGRAM_BUCKETS; ++i)
+      dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+}
+#endif
+
+bool
+chck_tqueue_get_stats(struct chck_tqueue *tqueue, struct chck_tqueue_stats *out_stats)
+{
+   assert(tqueue && out_stats);
+
+#if HAS_TQUEUE_STATS
+   struct chck_tqueue_counters *c = tqueue->tasks.stats;
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+   stats_depth(&tqueue->tasks);
+   out_stats->elapsed_ns = c->sampled - c->epoch;
+   out_stats->depth = c->depth;
+   out_stats->max_depth = c->max_depth;
+   out_stats->depth_ns = c->depth_ns;
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+
+   out_stats->dispatched = __atomic_load_n(&c->dispatched, __ATOMIC_RELAXED);
+   out_stats->completed = __atomic_load_n(&c->completed, __ATOMIC_RELAXED);
+   out_stats->full = __atomic_load_n(&c->full, __ATOMIC_RELAXED);
+   out_stats->blocked = __atomic_load_n(&c->blocked, __ATOMIC_RELAXED);
+   copy_histogram(&out_stats->wait, &c->wait);
+   copy_histogram(&out_stats->work, &c->work);
+   copy_histogram(&out_stats->collect, &c->collect);
+   return true;
+#else
+   (void)tqueue;
+   *out_stats = (struct chck_tqueue_stats){0};
+   return false;
+#endif
+}
+
+size_t
+chck_tqueue_get_worker_stats(struct chck_tqueue *tqueue, struct chck_tqueue_worker_stats *out_stats, size_t memb)
+{
+   assert(tqueue && (out_stats || !memb));
+
+#if HAS_TQUEUE_STATS
+   memb = (memb < tqueue->threads.count ? memb : tqueue->threads.count);
+   for (size_t i = 0; i < memb; ++i) {
+      out_stats[i].busy_ns = __atomic_load_n(&tqueue->tasks.stats->workers[i].busy_ns, __ATOMIC_RELAXED);
+      out_stats[i].tasks = __atomic_load_n(&tqueue->tasks.stats->workers[i].tasks, __ATOMIC_RELAXED);
+   }
+   return memb;
+#else
+   (void)tqueue, (void)out_stats, (void)memb;
+   return 0;
+#endif
+}
+
+void
+chck_tqueue_reset_stats(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+#if HAS_TQUEUE_STATS
+   struct chck_tqueue_counters *c = tqueue->tasks.stats;
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+
+   // Tasks in flight keep their timestamps.
+   __atomic_store_n(&c->dispatched, 0, __ATOMIC_RELAXED);
+   __atomic_store_n(&c->completed, 0, __ATOMIC_RELAXED);
+   __atomic_store_n(&c->full, 0, __ATOMIC_RELAXED);
+   __atomic_store_n(&c->blocked, 0, __ATOMIC_RELAXED);
+
+   struct chck_tqueue_histogram *histograms[] = { &c->wait, &c->work, &c->collect };
+   for (size_t i = 0; i < 3; ++i) {
+      uint64_t *fields = (uint64_t*)histograms[i];
+      for (size_t f = 0; f < sizeof(struct chck_tqueue_histogram) / sizeof(uint64_t); ++f)
+         __atomic_store_n(&fields[f], 0, __ATOMIC_RELAXED);
+   }
+
+   for (size_t i = 0; i < tqueue->threads.count; ++i) {
+      __atomic_store_n(&c->workers[i].busy_ns, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&c->workers[i].tasks, 0, __ATOMIC_RELAXED);
+   }
+
+   c->epoch = c->sampled = now_ns();
+   c->depth_ns = 0;
+   c->depth = c->max_depth = tqueue->tasks.count;
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+#else
+   (void)tqueue;
+#endif
+}
+
+void
+chck_tqueue_release(struct chck_tqueue *tqueue)
+{
+   // Allowed only on creator thread.
+   if (!tqueue || (tqueue->threads.self && !creator_thread(tqueue)))
+      return;
+
+   stop(tqueue);
+   pthread_mutex_destroy(&tqueue->tasks.mutex);
+   pthread_cond_destroy(&tqueue->tasks.notify);
+   pthread_cond_destroy(&tqueue->tasks.space);
+   pthread_cond_destroy(&tqueue->tasks.joined);
+
+   // Destruct every slot still in use, pending or completed but not collected.
+   // Collectless mode destructs completed tasks already, and returns their slots.
+   if (tqueue->tasks.lanes && tqueue->tasks.unused && tqueue->tasks.processed) {
+      memset(tqueue->tasks.processed, false, tqueue->tasks.qsize * sizeof(bool));
+
+      if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC) {
+         for (size_t slot; ring_pop(tqueue->tasks.available, &slot);)
+            tqueue->tasks.processed[slot] = true;
+      } else {
+         for (size_t i = 0; i < tqueue->tasks.nunused; ++i)
+            tqueue->tasks.processed[tqueue->tasks.unused[i]] = true;
+      }
+
+      for (size_t i = 0; i < tqueue->tasks.qsize; ++i) {
+         if (tqueue->tasks.processed[i])
+            continue;
+
+         // Async tasks that never got collected are resumed as cancelled, so nobody waits for them forever.
+         struct chck_tqueue_continuation *continuation = (tqueue->tasks.continuations ? &tqueue->tasks.continuations[i] : NULL);
+         if (continuation && continuation->resume)
+            continuation->resume(get_data(&tqueue->tasks, i), true, continuation->userdata);
+
+         struct chck_tqueue_lane *lane = get_lane(&tqueue->tasks, i);
+         if (lane->destructor)
+            lane->destructor(get_data(&tqueue->tasks, i));
+      }
+   }
+
+   if (tqueue->tasks.fd >= 0)
+      close(tqueue->tasks.fd);
+
+   if (tqueue->threads.workers) {
+      for (size_t i = 0; i < tqueue->threads.count; ++i)
+         free(tqueue->threads.workers[i].done.slots);
+   }
+
+   if (tqueue->tasks.lanes) {
+      for (size_t i = 0; i < tqueue->tasks.nlanes; ++i) {
+         free(tqueue->tasks.lanes[i].queue);
+         ring_destroy(tqueue->tasks.lanes[i].ring);
+      }
+   }
+
+   ring_destroy(tqueue->tasks.available);
+   ring_destroy(tqueue->tasks.completed);
+#if HAS_TQUEUE_STATS
+   if (tqueue->tasks.stats) {
+      free(tqueue->tasks.stats->queued);
+      free(tqueue->tasks.stats->started);
+      free(tqueue->tasks.stats->workers);
+      free(tqueue->tasks.stats);
+   }
+#endif
+
+   free(tqueue->tasks.continuations);
+   free(tqueue->tasks.nodes);
+   free(tqueue->tasks.edges);
+   free(tqueue->threads.options.cpus);
+   free(tqueue->threads.workers);
+   free(tqueue->tasks.lanes);
+   free(tqueue->tasks.retired);
+   free(tqueue->tasks.owners);
+   free(tqueue->tasks.emplaced);
+   free(tqueue->tasks.unused);
+   free(tqueue->tasks.processed);
+   free(tqueue->tasks.buffer);
+   free(tqueue->threads.t);
+   *tqueue = (struct chck_tqueue){0};
+}
+
+void
+chck_tqueue_set_fd(struct chck_tqueue *tqueue, int fd)
+{
+   assert(tqueue);
+
+   // Allowed only on creator thread.
+   if (!tqueue || !creator_thread(tqueue))
+      return;
+
+   if (tqueue->tasks.fd >= 0)
+      close(tqueue->tasks.fd);
+
+   tqueue->tasks.fd = dup(fd);
+   tqueue->tasks.fd_owned = false;
+   tqueue->tasks.signaled = false;
+}
+
+int
+chck_tqueue_create_eventfd(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   // Allowed only on creator thread.
+   if (!tqueue || !creator_thread(tqueue))
+      return -1;
+
+#ifdef __linux__
+   const int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+   if (fd < 0)
+      return -1;
+
+   if (tqueue->tasks.fd >= 0)
+      close(tqueue->tasks.fd);
+
+   tqueue->tasks.fd = fd;
+   tqueue->tasks.fd_owned = true;
+   tqueue->tasks.signaled = false;
+   return fd;
+#else
+   return -1;
+#endif
+}
+
+int
+chck_tqueue_get_fd(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   // Allowed only on creator thread.
+   if (!tqueue || !creator_thread(tqueue))
+      return -1;
+
+   return tqueue->tasks.fd;
+}
+
+void
+chck_tqueue_set_zeroing(struct chck_tqueue *tqueue, bool zero)
+{
+   assert(tqueue);
+   // Whether to zero slots after tasks are done, emplaced slots have stale data without.
+   tqueue->tasks.zero = zero;
+}
+
+bool
+chck_tqueue_get_zeroing(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return tqueue->tasks.zero;
+}
+
+void
+chck_tqueue_set_keep_alive(struct chck_tqueue *tqueue, bool keep_alive)
+{
+   assert(tqueue);
+   // Whether to destroy or keep thread alive when no tasks.
+   tqueue->threads.keep_alive = keep_alive;
+}
+
+bool
+chck_tqueue_get_keep_alive(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return tqueue->threads.keep_alive;
+}
+
+bool
+chck_tqueue_set_min_threads(struct chck_tqueue *tqueue, size_t min)
+{
+   assert(tqueue);
+
+   if (min > tqueue->threads.count)
+      return false;
+
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+   tqueue->threads.min = min;
+
+   for (bool started = true; started && __atomic_load_n(&tqueue->threads.running, __ATOMIC_ACQUIRE) && !tqueue->tasks.cancel && tqueue->threads.alive < min;)
+      started = spawn(tqueue);
+
+   // Idle workers wait again, with timeout if they are above min now.
+   pthread_cond_broadcast(&tqueue->tasks.notify);
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+   return true;
+}
+
+size_t
+chck_tqueue_get_min_threads(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return tqueue->threads.min;
+}
+
+size_t
+chck_tqueue_get_threads(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return __atomic_load_n(&tqueue->threads.alive, __ATOMIC_SEQ_CST);
+}
+
+void
+chck_tqueue_set_idle_timeout(struct chck_tqueue *tqueue, uint64_t timeout_ns)
+{
+   assert(tqueue);
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+   tqueue->threads.idle_timeout = timeout_ns;
+   pthread_cond_broadcast(&tqueue->tasks.notify);
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+}
+
+uint64_t
+chck_tqueue_get_idle_timeout(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return tqueue->threads.idle_timeout;
+}
+
+void
+chck_tqueue_set_spin(struct chck_tqueue *tqueue, size_t spin)
+{
+   assert(tqueue);
+
+   // Spinning only helps when the thread we wait for runs on another cpu.
+   if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+      spin = 0;
+
+   __atomic_store_n(&tqueue->threads.spin, spin, __ATOMIC_RELAXED);
+}
+
+size_t
+chck_tqueue_get_spin(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return __atomic_load_n(&tqueue->threads.spin, __ATOMIC_RELAXED);
+}
+
+static bool
+prepare_rings(struct chck_tasks *tasks)
+{
+   assert(tasks);
+
+   // Lanes added after the MPMC scheduler was chosen get their rings in add_lane.
+   if ((!tasks->available && !(tasks->available = ring_create(tasks->qsize * 2))) ||
+       (!tasks->completed && !(tasks->completed = ring_create(tasks->qsize * 2))))
+      return false;
+
+   for (size_t i = 0; i < tasks->nlanes; ++i) {
+      if (!tasks->lanes[i].ring && !(tasks->lanes[i].ring = ring_create(tasks->qsize * 2)))
+         return false;
+   }
+
+   return true;
+}
+
+static bool
+reset(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+
+   // Queue positions can only be reset when there are no tasks in flight.
+   pthread_mutex_lock(&tqueue->tasks.mutex);
+   const size_t count = tqueue->tasks.count;
+   pthread_mutex_unlock(&tqueue->tasks.mutex);
+
+   if (count > 0)
+      return false;
+
+   stop(tqueue);
+   tqueue->tasks.tcount = 0;
+
+   for (size_t i = 0; i < tqueue->tasks.nlanes; ++i) {
+      struct chck_tqueue_lane *lane = &tqueue->tasks.lanes[i];
+      lane->head = lane->thead = lane->tail;
+      lane->tcount = 0;
+      lane->ws.submitted = lane->ws.claimed = lane->tail;
+   }
+
+   for (size_t i = 0; i < tqueue->threads.count; ++i)
+      tqueue->threads.workers[i].lane = 0;
+
+   return true;
+}
+
+bool
+chck_tqueue_set_scheduler(struct chck_tqueue *tqueue, enum chck_tqueue_scheduler scheduler)
+{
+   assert(tqueue);
+
+   // Allowed only on creator thread.
+   if (!tqueue || !creator_thread(tqueue))
+      return false;
+
+   if (tqueue->tasks.scheduler == scheduler)
+      return true;
+
+   // Schedulers track pending tasks differently, so we can only switch when there are none.
+   if (!reset(tqueue) || (scheduler == CHCK_TQUEUE_MPMC && !prepare_rings(&tqueue->tasks)))
+      return false;
+
+   // MPMC keeps free slots in a ring instead of the stack, every slot is free now.
+   struct chck_tasks *tasks = &tqueue->tasks;
+   if (scheduler == CHCK_TQUEUE_MPMC) {
+      ring_init(tasks->available);
+
+      for (size_t i = 0; i < tasks->qsize; ++i)
+         ring_put(tasks->available, i);
+
+      tasks->order = CHCK_TQUEUE_COMPLETION_ORDER;
+   } else if (tasks->scheduler == CHCK_TQUEUE_MPMC) {
+      for (size_t i = 0; i < tasks->qsize; ++i)
+         tasks->unused[i] = tasks->qsize - i - 1;
+
+      tasks->nunused = tasks->qsize;
+   }
+
+   tasks->scheduler = scheduler;
+   return true;
+}
+
+enum chck_tqueue_scheduler
+chck_tqueue_get_scheduler(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return tqueue->tasks.scheduler;
+}
+
+bool
+chck_tqueue_set_order(struct chck_tqueue *tqueue, enum chck_tqueue_order order)
+{
+   assert(tqueue);
+
+   // Allowed only on creator thread.
+   if (!tqueue || !creator_thread(tqueue))
+      return false;
+
+   if (tqueue->tasks.order == order)
+      return true;
+
+   // Callbacks may run on many threads at once, so there is no order to keep.
+   if (tqueue->tasks.scheduler == CHCK_TQUEUE_MPMC)
+      return false;
+
+   // Completion order does not track the oldest task, so we can only switch when there are none.
+   if (!reset(tqueue))
+      return false;
+
+   tqueue->tasks.order = order;
+   return true;
+}
+
+enum chck_tqueue_order
+chck_tqueue_get_order(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return tqueue->tasks.order;
+}
+
+static bool
+parallel(struct chck_tqueue *tqueue, struct chck_tqueue_job *job)
+{
+   assert(tqueue && job);
+   struct chck_tasks *tasks = &tqueue->tasks;
+
+   // Allowed only on creator thread.
+   if (!tqueue || !creator_thread(tqueue))
+      return false;
+
+   // Range that fits in single chunk is not worth waking the workers for.
+   const bool shared = (job->end - job->next > job->grain && tqueue->threads.count > 0 && start(tqueue));
+
+   if (shared) {
+      pthread_mutex_lock(&tasks->mutex);
+      __atomic_store_n(&tasks->job, job, __ATOMIC_RELAXED);
+      grow(tqueue, tqueue->threads.count);
+      pthread_cond_broadcast(&tasks->notify);
+      pthread_mutex_unlock(&tasks->mutex);
+   }
+
+   // Calling thread takes part, and waits only for the workers still finishing their chunks.
+   void *partial = help(job);
+
+   pthread_mutex_lock(&tasks->mutex);
+   __atomic_store_n(&tasks->job, NULL, __ATOMIC_RELAXED);
+
+   if (partial)
+      job->combine(job->result, partial, job->userdata);
+
+   while (job->refs > 0)
+      pthread_cond_wait(&tasks->joined, &tasks->mutex);
+
+   pthread_mutex_unlock(&tasks->mutex);
+   return true;
+}
+
+bool
+chck_parallel_for(struct chck_tqueue *tqueue, size_t begin, size_t end, size_t grain, void (*fn)(size_t begin, size_t end, void *userdata), void *userdata)
+{
+   assert(tqueue && fn);
+
+   if (!fn)
+      return false;
+
+   if (begin >= end)
+      return true;
+
+   struct chck_tqueue_job job = {
+      .fn = fn,
+      .userdata = userdata,
+      .next = begin,
+      .end = end,
+      .grain = (grain > 0 ? grain : 1),
+      .parts = tqueue->threads.count + 1,
+   };
+
+   return parallel(tqueue, &job);
+}
+
+bool
+chck_parallel_reduce(struct chck_tqueue *tqueue, size_t begin, size_t end, size_t grain, void *result, size_t rsize, void (*fn)(size_t begin, size_t end, void *partial, void *userdata), void (*combine)(void *result, const void *partial, void *userdata), void *userdata)
+{
+   assert(tqueue && result && rsize > 0 && fn && combine);
+
+   if (!result || !rsize || !fn || !combine)
+      return false;
+
+   if (begin >= end)
+      return true;
+
+   struct chck_tqueue_job job = {
+      .reduce = fn,
+      .combine = combine,
+      .userdata = userdata,
+      .result = result,
+      .next = begin,
+      .end = end,
+      .grain = (grain > 0 ? grain : 1),
+      .rsize = rsize,
+      .parts = tqueue->threads.count + 1,
+   };
+
+   if (!(job.partials = chck_malloc_mul_of(job.parts, rsize)))
+      return false;
+
+   for (size_t i = 0; i < job.parts; ++i)
+      memcpy(job.partials + i * rsize, result, rsize);
+
+   const bool ret = parallel(tqueue, &job);
+   free(job.partials);
+   return ret;
+}
+
+static bool
+add_lane(struct chck_tasks *tasks, size_t msize, void (*work)(), void (*callback)(), void (*destructor)(), size_t *out_lane)
+{
+   assert(tasks && msize > 0 && work);
+
+   size_t *queue;
+   if (!(queue = chck_calloc_of(tasks->qsize, sizeof(size_t))))
+      return false;
+
+   struct chck_tqueue_ring *ring = NULL;
+   struct chck_tqueue_lane *lanes = NULL;
+   if ((tasks->scheduler == CHCK_TQUEUE_MPMC && !(ring = ring_create(tasks->qsize * 2))) ||
+       !(lanes = chck_realloc_mul_of(tasks->lanes, tasks->nlanes + 1, sizeof(struct chck_tqueue_lane)))) {
+      ring_destroy(ring);
+      free(queue);
+      return false;
+   }
+
+   lanes[tasks->nlanes] = (struct chck_tqueue_lane){
+      .work = work,
+      .callback = callback,
+      .destructor = destructor,
+      .msize = msize,
+      .queue = queue,
+      .ring = ring,
+   };
+
+   if (out_lane)
+      *out_lane = tasks->nlanes;
+
+   tasks->lanes = lanes;
+   tasks->nlanes++;
+   return true;
+}
+
+bool
+chck_tqueue_add_lane(struct chck_tqueue *tqueue, size_t msize, void (*work)(), void (*callback)(), void (*destructor)(), size_t *out_lane)
+{
+   assert(tqueue && work && msize > 0);
+
+   // Allowed only on creator thread.
+   if (!tqueue || !creator_thread(tqueue))
+      return false;
+
+   if (!msize || !work || msize > tqueue->tasks.msize)
+      return false;
+
+   // Workers access lanes without locking, so we can only add lanes when there are no tasks.
+   if (!reset(tqueue))
+      return false;
+
+   return add_lane(&tqueue->tasks, msize, work, callback, destructor, out_lane);
+}
+
+void
+chck_tqueue_set_lane_quota(struct chck_tqueue *tqueue, size_t quota)
+{
+   assert(tqueue);
+   // 0 disables the quota, and lower lanes only run when higher lanes have nothing to do.
+   tqueue->tasks.quota = quota;
+}
+
+size_t
+chck_tqueue_get_lane_quota(struct chck_tqueue *tqueue)
+{
+   assert(tqueue);
+   return tqueue->tasks.quota;
+}
+
+#ifdef __linux__
+static bool
+numa_node_cpus(int node, int **out_cpus, size_t *out_ncpus)
+{
+   assert(out_cpus && out_ncpus);
+
+   char path[64];
+   snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+   FILE *f;
+   if (node < 0 || !(f = fopen(path, "r")))
+      return false;
+
+   // cpulist is in format of 0-3,8,10-11
+   int *cpus = NULL;
+   size_t ncpus = 0;
+   for (int first, last, c = ','; c == ',' && fscanf(f, "%d", &first) == 1;) {
+      last = first;
+
+      if ((c = fgetc(f)) == '-') {
+         if (fscanf(f, "%d", &last) != 1)
+            break;
+
+         c = fgetc(f);
+      }
+
+      for (int cpu = first; cpu <= last; ++cpu) {
+         int *n;
+         if (!(n = chck_realloc_mul_of(cpus, ncpus + 1, sizeof(int))))
+            goto fail;
+
+         cpus = n;
+         cpus[ncpus++] = cpu;
+      }
+   }
+
+   fclose(f);
+
+   if (!ncpus)
+      return false;
+
+   *out_cpus = cpus;
+   *out_ncpus = ncpus;
+   return true;
+
+fail:
+   fclose(f);
+   free(cpus);
+   return false;
+}
+#endif
+
+static bool
+set_options(struct chck_tqueue *tqueue, const struct chck_tqueue_options *options)
+{
+   assert(tqueue && options);
+
+   tqueue->threads.options.stack_size = options->stack_size;
+   tqueue->threads.options.policy = options->policy;
+   tqueue->threads.options.priority = options->priority;
+
+   if (options->name)
+      snprintf(tqueue->threads.options.name, sizeof(tqueue->threads.options.name), "%s", options->name);
+
+#ifdef __linux__
+   if (options->cpus && options->ncpus > 0) {
+      if (!(tqueue->threads.options.cpus = chck_malloc_mul_of(options->ncpus, sizeof(int))))
+         return false;
+
+      for (size_t i = 0; i < options->ncpus; ++i) {
+         if (options->cpus[i] < 0 || options->cpus[i] >= CPU_SETSIZE)
+            return false;
+      }
+
+      memcpy(tqueue->threads.options.cpus, options->cpus, options->ncpus * sizeof(int));
+      tqueue->threads.options.ncpus = options->ncpus;
+      tqueue->threads.options.spread = true;
+   } else if (options->use_numa_node) {
+      if (!numa_node_cpus(options->numa_node, &tqueue->threads.options.cpus, &tqueue->threads.options.ncpus))
+         return false;
+   }
+#endif
+
+   return true;
+}
+
+bool
+chck_tqueue_with_options(struct chck_tqueue *tqueue, size_t nthreads, size_t qsize, size_t msize, void (*work)(), void (*callback)(), void (*destructor)(), const struct chck_tqueue_options *options)
+{
+   assert(tqueue && options);
+
+   if (!chck_tqueue(tqueue, nthreads, qsize, msize, work, callback, destructor))
+      return false;
+
+   if (!options || !set_options(tqueue, options)) {
+      chck_tqueue_release(tqueue);
+      return false;
+   }
+
+   return true;
+}
+
+bool
+chck_tqueue(struct chck_tqueue *tqueue, size_t nthreads, size_t qsize, size_t msize, void (*work)(), void (*callback)(), void (*destructor)())
+{
+   assert(tqueue && work && msize > 0);
+   *tqueue = (struct chck_tqueue){ .tasks = { .fd = - 1 } };
+
+   if (!msize || !work)
+      return false;
+
+   if (!(tqueue->tasks.buffer = chck_calloc_of(qsize, msize)) ||
+       !(tqueue->tasks.processed = chck_calloc_of(qsize, sizeof(bool))) ||
+       !(tqueue->tasks.unused = chck_calloc_of(qsize, sizeof(size_t))) ||
+       !(tqueue->tasks.owners = chck_calloc_of(qsize, sizeof(size_t))) ||
+       !(tqueue->tasks.emplaced = chck_calloc_of(qsize, sizeof(bool))) ||
+       !(tqueue->tasks.retired = chck_calloc_of(qsize, sizeof(size_t))))
+      goto fail;
+
+   // Stack pops from the end, hand out the slots in order.
+   for (size_t i = 0; i < qsize; ++i)
+      tqueue->tasks.unused[i] = qsize - i - 1;
+
+   tqueue->tasks.nunused = qsize;
+
+   // Timed waits for space and idle workers use monotonic deadlines.
+   pthread_condattr_t attr;
+   if (pthread_condattr_init(&attr) != 0)
+      goto fail;
+
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+   if (pthread_mutex_init(&tqueue->tasks.mutex, NULL) != 0 ||
+       pthread_cond_init(&tqueue->tasks.notify, &attr) != 0 ||
+       pthread_cond_init(&tqueue->tasks.space, &attr) != 0 ||
+       pthread_cond_init(&tqueue->tasks.joined, NULL) != 0) {
+      pthread_condattr_destroy(&attr);
+      goto fail;
+   }
+
+   pthread_condattr_destroy(&attr);
+
+   if (!(tqueue->threads.t = chck_calloc_of(nthreads, sizeof(pthread_t))) ||
+       !(tqueue->threads.workers = chck_calloc_of(nthreads, sizeof(struct chck_tqueue_worker))))
+      goto fail;
+
+   tqueue->threads.count = tqueue->threads.min = nthreads;
+
+   for (size_t i = 0; i < nthreads; ++i) {
+      tqueue->threads.workers[i].tqueue = tqueue;
+
+      if (!(tqueue->threads.workers[i].done.slots = chck_calloc_of(qsize, sizeof(size_t))))
+         goto fail;
+   }
+
+#if HAS_TQUEUE_STATS
+   if (!(tqueue->tasks.stats = chck_calloc_of(1, sizeof(struct chck_tqueue_counters))) ||
+       !(tqueue->tasks.stats->queued = chck_calloc_of(qsize, sizeof(uint64_t))) ||
+       !(tqueue->tasks.stats->started = chck_calloc_of(qsize, sizeof(uint64_t))) ||
+       !(tqueue->tasks.stats->workers = chck_calloc_of(nthreads, sizeof(struct chck_tqueue_worker_stats))))
+      goto fail;
+
+   tqueue->tasks.stats->epoch = tqueue->tasks.stats->sampled = now_ns();
+#endif
 
    tqueue->threads.self = pthread_self();
-   tqueue->threads.count = nthreads;
    tqueue->tasks.msize = msize;
    tqueue->tasks.qsize = qsize;
-   tqueue->tasks.work = work;
-   tqueue->tasks.callback = callback;
-   tqueue->tasks.destructor = destructor;
+   tqueue->tasks.quota = LANE_QUOTA;
+   tqueue->tasks.zero = true;
+
+   if (!add_lane(&tqueue->tasks, msize, work, callback, destructor, NULL))
+      goto fail;
+
    return true;
 
 fail:
@@ -7,38 +7,273 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+enum chck_tqueue_scheduler {
+   // workers dequeue from the shared ring under single mutex
+   CHCK_TQUEUE_SHARED,
+   // workers claim batches from the ring lock-free into their own deques, idle workers steal from others
+   CHCK_TQUEUE_WORK_STEALING,
+   // any thread may add tasks and collect, slots go around in lock-free rings, callbacks run in completion order
+   // tasks with dependencies are not supported
+   CHCK_TQUEUE_MPMC,
+};
+
+enum chck_tqueue_order {
+   // callbacks run in the order tasks were added, completed tasks wait for the earlier ones
+   CHCK_TQUEUE_SUBMISSION_ORDER,
+   // callbacks run in the order tasks complete, slow task does not hold back the others
+   CHCK_TQUEUE_COMPLETION_ORDER,
+};
+
+// most dependencies single task can have
+#define CHCK_TQUEUE_MAX_DEPS 4
+
+// histogram buckets, bucket i counts durations in [2^i, 2^(i+1)) ns, and the last one everything above
+#define CHCK_TQUEUE_HISTOGRAM_BUCKETS 32
+
+struct chck_tqueue_worker;
+struct chck_tqueue_job;
+struct chck_tqueue_node;
+struct chck_tqueue_counters;
+struct chck_tqueue_ring;
+
+// handle to task, stays valid after the task is collected, but then refers to finished task
+struct chck_tqueue_task {
+   size_t slot, generation;
+};
+
+// continuation of async task, resumed on creator thread when the task is collected
+// cancelled tasks skip work and lane callback, and resume with cancelled set
+// tasks still uncollected on release are resumed as cancelled as well
+struct chck_tqueue_continuation {
+   void (*resume)(void *data, bool cancelled, void *userdata);
+   void *userdata;
+};
+
+struct chck_tqueue_histogram {
+   uint64_t count, sum_ns, max_ns;
+   uint64_t buckets[CHCK_TQUEUE_HISTOGRAM_BUCKETS];
+};
+
+// since creation or chck_tqueue_reset_stats
+struct chck_tqueue_stats {
+   uint64_t elapsed_ns;
+
+   // tasks dispatched to workers, and done (collected, or retired by worker when lane has no callback)
+   uint64_t dispatched, completed;
+
+   // adds that found the queue full, and of those the ones that waited for space
+   uint64_t full, blocked;
+
+   // dispatch to start of work, work itself, start of work to collect
+   struct chck_tqueue_histogram wait, work, collect;
+
+   // slots in use now and at most, average depth is depth_ns / elapsed_ns
+   size_t depth, max_depth;
+   uint64_t depth_ns;
+};
+
+struct chck_tqueue_worker_stats {
+   // utilization is busy_ns / elapsed_ns of chck_tqueue_stats
+   uint64_t busy_ns, tasks;
+};
+
+struct chck_tqueue_options {
+   // workers are pinned round-robin to these cpus (linux)
+   const int *cpus;
+   size_t ncpus;
+
+   // workers run on the cpus of numa_node (linux), ignored when cpus are given
+   bool use_numa_node;
+   int numa_node;
+
+   // 0 for default
+   size_t stack_size;
+
+   // SCHED_* policy and its priority, SCHED_OTHER inherits from the creator thread
+   int policy, priority;
+
+   // workers are named as "<name>/<index>" (truncated to 15 characters), NULL for no names
+   const char *name;
+};
+
+struct chck_tqueue_lane {
+   void (*work)();
+   void (*callback)();
+   void (*destructor)();
+   size_t msize;
+
+   // ring of slot indices in submission order
+   size_t *queue;
+
+   // queue positions: head (oldest uncollected), thead (next to dispatch), tail (next free)
+   // tcount is number of tasks waiting for dispatch
+   size_t head, thead, tail, tcount;
+
+   // work stealing scheduler state, submitted is kept congruent with tail
+   struct {
+      size_t submitted, claimed;
+   } ws;
+
+   // MPMC scheduler ring of pending slots
+   struct chck_tqueue_ring *ring;
+};
+
 struct chck_tqueue {
    struct chck_tasks {
+      // task data, qsize slots of msize
       uint8_t *buffer;
+
+      // completed slots waiting for their turn in submission order
       bool *processed;
-      void (*work)();
-      void (*callback)();
-      void (*destructor)();
+
+      // stack of unused slots
+      size_t *unused, nunused;
+
+      // lane of each slot in use
+      size_t *owners;
+
+      // slots emplaced but not yet committed or discarded
+      bool *emplaced;
+
+      // dependency graph state of each slot, and CHCK_TQUEUE_MAX_DEPS edges for each slot
+      // allocated when tasks with dependencies are first added
+      struct chck_tqueue_node *nodes;
+      size_t *edges;
+
+      // continuation of each slot, allocated when async tasks are first added
+      struct chck_tqueue_continuation *continuations;
+
+      // scratch for slots retired by single collect
+      size_t *retired;
+
+      // lanes in priority order, lane 0 is the lowest
+      // every quota:th task a worker takes from the lowest lane with tasks, so it won't starve
+      struct chck_tqueue_lane *lanes;
+      size_t nlanes, quota;
+
       size_t msize;
       size_t qsize;
-      size_t head, thead, tail, count, tcount;
+      // count is number of slots in use, tcount number of tasks waiting for dispatch in all lanes
+      size_t count, tcount;
       pthread_mutex_t mutex;
       pthread_cond_t notify;
+
+      // signaled when tasks complete or are collected, for producers waiting on full queue
+      pthread_cond_t space;
+      size_t waiting;
+
+      // parallel for/reduce job workers help with, signaled when last worker leaves the job
+      struct chck_tqueue_job *job;
+      pthread_cond_t joined;
+
       int fd;
+      // fd is our own non-blocking eventfd, write to fd is pending since last collect
+      bool fd_owned, signaled;
       bool cancel;
+
+      // zero slots after tasks are done
+      bool zero;
+
+      // MPMC scheduler rings of free and completed slots, allocated when the scheduler is first used
+      // free slots are in available instead of the unused stack, and count is updated without the mutex
+      struct chck_tqueue_ring *available, *completed;
+
+      // NULL unless compiled with CHCK_TQUEUE_STATS
+      struct chck_tqueue_counters *stats;
+
+      // workers waiting on notify, and workers spinning before they wait
+      size_t sleepers, spinning;
+
+      enum chck_tqueue_scheduler scheduler;
+      enum chck_tqueue_order order;
    } tasks;
 
    struct {
       pthread_t *t;
+      struct chck_tqueue_worker *workers;
+
+      // from chck_tqueue_options, workers are pinned round-robin to cpus when spread, otherwise to all of them
+      struct {
+         int *cpus;
+         size_t ncpus, stack_size;
+         int policy, priority;
+         bool spread;
+         char name[16];
+      } options;
+
       pthread_t self;
-      size_t count;
+
+      // count is most workers there can be, alive are the ones running now, min are kept alive when idle
+      // workers idle for longer than idle_timeout exit, 0 to never exit, they spin for spin rounds before waiting
+      size_t count, alive, min, spin;
+      uint64_t idle_timeout;
       bool running;
       bool keep_alive;
    } threads;
 };
 
+/* block != 0, waits for space when queue is full (the value is not used as sleep interval anymore) */
 bool chck_tqueue_add_task(struct chck_tqueue *tqueue, void *data, useconds_t block);
+bool chck_tqueue_add_task_timed(struct chck_tqueue *tqueue, void *data, uint64_t timeout_ns);
+size_t chck_tqueue_add_tasks(struct chck_tqueue *tqueue, const void *items, size_t memb, useconds_t block); /* struct item *items; */
+bool chck_tqueue_add_lane_task(struct chck_tqueue *tqueue, size_t lane, void *data, useconds_t block);
+size_t chck_tqueue_add_lane_tasks(struct chck_tqueue *tqueue, size_t lane, const void *items, size_t memb, useconds_t block);
+/* task runs once work of all its dependencies is done, without waiting for collect, out_task may be used as dependency for others */
+bool chck_tqueue_add_lane_task_after(struct chck_tqueue *tqueue, size_t lane, void *data, const struct chck_tqueue_task *deps, size_t ndeps, useconds_t block, struct chck_tqueue_task *out_task);
+bool chck_tqueue_then(struct chck_tqueue *tqueue, const struct chck_tqueue_task *task, size_t lane, void *data, useconds_t block, struct chck_tqueue_task *out_task);
+bool chck_tqueue_task_done(struct chck_tqueue *tqueue, const struct chck_tqueue_task *task);
+/* continuation is resumed from collect after lane callback and before destructor, lane does not need callback, not supported with CHCK_TQUEUE_MPMC */
+bool chck_tqueue_add_lane_task_async(struct chck_tqueue *tqueue, size_t lane, void *data, useconds_t block, const struct chck_tqueue_continuation *continuation, struct chck_tqueue_task *out_task);
+/* cancels task that has not started yet, and transitively its dependents that have not started either.
+ * destructor and continuation still run from collect, false if task already started */
+bool chck_tqueue_cancel_task(struct chck_tqueue *tqueue, const struct chck_tqueue_task *task);
+/* reserves slot to be filled in place, must be followed by commit or discard.
+ * commit and discard return false for data that is not an emplaced slot, including second commit or discard */
+void* chck_tqueue_emplace_lane_task(struct chck_tqueue *tqueue, size_t lane, useconds_t block);
+void* chck_tqueue_emplace_task(struct chck_tqueue *tqueue, useconds_t block);
+bool chck_tqueue_commit_task(struct chck_tqueue *tqueue, void *data);
+bool chck_tqueue_discard_task(struct chck_tqueue *tqueue, void *data);
+/* lanes added later have higher priority, lane 0 is the one given to chck_tqueue, msize can't exceed the queue's msize */
+bool chck_tqueue_add_lane(struct chck_tqueue *tqueue, size_t msize, void (*work)(), void (*callback)(), void (*destructor)(), size_t *out_lane);
+void chck_tqueue_set_lane_quota(struct chck_tqueue *tqueue, size_t quota);
+size_t chck_tqueue_get_lane_quota(struct chck_tqueue *tqueue);
+/* only on creator thread, unless CHCK_TQUEUE_MPMC scheduler is used */
 size_t chck_tqueue_collect(struct chck_tqueue *tqueue);
 void chck_tqueue_set_fd(struct chck_tqueue *tqueue, int fd);
 int chck_tqueue_get_fd(struct chck_tqueue *tqueue);
+/* creates non-blocking eventfd owned by the queue, readable when there is something to collect, -1 if unsupported */
+int chck_tqueue_create_eventfd(struct chck_tqueue *tqueue);
 void chck_tqueue_set_keep_alive(struct chck_tqueue *tqueue, bool keep_alive);
 bool chck_tqueue_get_keep_alive(struct chck_tqueue *tqueue);
+/* workers are started on demand up to nthreads given to chck_tqueue, min of them stay alive when idle */
+bool chck_tqueue_set_min_threads(struct chck_tqueue *tqueue, size_t min);
+size_t chck_tqueue_get_min_threads(struct chck_tqueue *tqueue);
+/* number of workers alive right now */
+size_t chck_tqueue_get_threads(struct chck_tqueue *tqueue);
+/* workers above min exit after idling for timeout_ns, 0 (default) keeps them alive */
+void chck_tqueue_set_idle_timeout(struct chck_tqueue *tqueue, uint64_t timeout_ns);
+uint64_t chck_tqueue_get_idle_timeout(struct chck_tqueue *tqueue);
+/* rounds idle worker polls for tasks before it waits to be woken up, 0 (default) waits right away, always 0 on single cpu */
+void chck_tqueue_set_spin(struct chck_tqueue *tqueue, size_t spin);
+size_t chck_tqueue_get_spin(struct chck_tqueue *tqueue);
+/* slots are zeroed after tasks are done by default, without emplaced slots contain data of previous task */
+void chck_tqueue_set_zeroing(struct chck_tqueue *tqueue, bool zero);
+bool chck_tqueue_get_zeroing(struct chck_tqueue *tqueue);
+bool chck_tqueue_set_scheduler(struct chck_tqueue *tqueue, enum chck_tqueue_scheduler scheduler);
+enum chck_tqueue_scheduler chck_tqueue_get_scheduler(struct chck_tqueue *tqueue);
+bool chck_tqueue_set_order(struct chck_tqueue *tqueue, enum chck_tqueue_order order);
+enum chck_tqueue_order chck_tqueue_get_order(struct chck_tqueue *tqueue);
+/* runs fn over [begin, end) in chunks of at least grain on the workers and calling thread, returns when all chunks are done */
+bool chck_parallel_for(struct chck_tqueue *tqueue, size_t begin, size_t end, size_t grain, void (*fn)(size_t begin, size_t end, void *userdata), void *userdata);
+/* result must hold identity on entry, every thread reduces to own copy of it, and the copies are combined to result in unspecified order */
+bool chck_parallel_reduce(struct chck_tqueue *tqueue, size_t begin, size_t end, size_t grain, void *result, size_t rsize, void (*fn)(size_t begin, size_t end, void *partial, void *userdata), void (*combine)(void *result, const void *partial, void *userdata), void *userdata);
+/* snapshot of the counters, false when compiled without CHCK_TQUEUE_STATS */
+bool chck_tqueue_get_stats(struct chck_tqueue *tqueue, struct chck_tqueue_stats *out_stats);
+/* returns number of workers written to out_stats, 0 when compiled without CHCK_TQUEUE_STATS */
+size_t chck_tqueue_get_worker_stats(struct chck_tqueue *tqueue, struct chck_tqueue_worker_stats *out_stats, size_t memb);
+void chck_tqueue_reset_stats(struct chck_tqueue *tqueue);
 void chck_tqueue_release(struct chck_tqueue *tqueue);
 bool chck_tqueue(struct chck_tqueue *tqueue, size_t nthreads, size_t qsize, size_t msize, void (*work)(), void (*callback)(), void (*destructor)());
+bool chck_tqueue_with_options(struct chck_tqueue *tqueue, size_t nthreads, size_t qsize, size_t msize, void (*work)(), void (*callback)(), void (*destructor)(), const struct chck_tqueue_options *options);
 
 #endif /* __chck_dispatch_h__ */
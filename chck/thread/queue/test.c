@@ -1,8 +1,16 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE // pthread_getname_np, sched_getcpu
+#endif
+
 #include "queue.h"
+#include <chck/pool/pool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 #ifdef __linux__
+#  include <sched.h>
+#  include <string.h>
 #  include <sys/eventfd.h>
 #  include <poll.h>
 #endif
@@ -36,6 +44,416 @@ destructor(struct item *item)
    assert((item->a == 1 && item->c == 2) || (item->a == 2 && item->c == 1));
 }
 
+struct counted {
+   size_t index;
+   size_t value;
+};
+
+static size_t collected;
+static size_t collected_sum;
+
+static void
+work_counted(struct counted *item)
+{
+   assert(item);
+   item->value = item->index * 2;
+}
+
+static void
+work_slow(struct counted *item)
+{
+   assert(item);
+   usleep(20000);
+   item->value = item->index * 2;
+}
+
+static void
+work_first_slow(struct counted *item)
+{
+   assert(item);
+   if (item->index == 0)
+      usleep(200000);
+   item->value = item->index * 2;
+}
+
+static void
+callback_counted(struct counted *item)
+{
+   assert(item);
+   assert(item->value == item->index * 2);
+   collected_sum += item->index;
+   ++collected;
+}
+
+struct urgent {
+   size_t index;
+};
+
+static size_t urgent_collected;
+static size_t ran[64], nran;
+
+static void
+work_lane_low(struct counted *item)
+{
+   assert(item);
+   if (item->index == 0)
+      usleep(20000);
+   item->value = item->index * 2;
+   if (nran < 64)
+      ran[nran++] = 0;
+}
+
+static void
+work_lane_high(struct urgent *item)
+{
+   assert(item);
+   if (nran < 64)
+      ran[nran++] = 1;
+}
+
+static void
+work_urgent(struct urgent *item)
+{
+   assert(item);
+   item->index *= 3;
+}
+
+static void
+callback_urgent(struct urgent *item)
+{
+   assert(item && item->index % 3 == 0);
+   ++urgent_collected;
+}
+
+#ifdef __linux__
+static void
+work_options(struct counted *item)
+{
+   assert(item);
+   char name[16];
+   assert(pthread_getname_np(pthread_self(), name, sizeof(name)) == 0);
+   assert(!strcmp(name, "chck-tqueue-t/0"));
+   assert(sched_getcpu() == 0);
+   item->value = item->index * 2;
+}
+#endif
+
+static void
+square_items(size_t begin, size_t end, void *userdata)
+{
+   struct chck_iter_pool *pool = userdata;
+   assert(pool && begin < end);
+
+   for (size_t i = begin; i < end; ++i) {
+      size_t *v = chck_iter_pool_get(pool, i);
+      *v = *v * *v;
+   }
+}
+
+static void
+sum_items(size_t begin, size_t end, void *partial, void *userdata)
+{
+   struct chck_iter_pool *pool = userdata;
+   assert(pool && partial && begin < end);
+
+   for (size_t i = begin; i < end; ++i)
+      *(size_t*)partial += *(size_t*)chck_iter_pool_get(pool, i);
+}
+
+static void
+sum_combine(void *result, const void *partial, void *userdata)
+{
+   assert(result && partial && userdata);
+   *(size_t*)result += *(const size_t*)partial;
+}
+
+struct staged {
+   size_t *counter;
+   size_t after;
+};
+
+static size_t staged_collected;
+
+static void
+work_staged(struct staged *item)
+{
+   assert(item);
+   // all dependencies have done their work before us
+   assert(__atomic_load_n(item->counter, __ATOMIC_ACQUIRE) >= item->after);
+   __atomic_add_fetch(item->counter, 1, __ATOMIC_ACQ_REL);
+}
+
+static void
+callback_staged(struct staged *item)
+{
+   assert(item);
+   ++staged_collected;
+}
+
+struct resumed {
+   size_t count, sum, cancelled;
+};
+
+static size_t destructed;
+
+static void
+destructor_counted(struct counted *item)
+{
+   assert(item);
+   ++destructed;
+}
+
+static void
+resume_counted(void *data, bool cancelled, void *userdata)
+{
+   struct counted *item = data;
+   struct resumed *resumed = userdata;
+   assert(item && resumed);
+
+   // runs on creator thread, before destructor
+   if (cancelled) {
+      ++resumed->cancelled;
+   } else {
+      assert(item->value == item->index * 2);
+      resumed->sum += item->index;
+   }
+
+   ++resumed->count;
+}
+
+static double
+bench_submit(size_t nthreads, size_t iters, size_t batch)
+{
+   struct chck_tqueue tqueue;
+   assert(chck_tqueue(&tqueue, nthreads, 4096, sizeof(struct counted), work_counted, callback_counted, NULL));
+   chck_tqueue_set_keep_alive(&tqueue, true);
+
+   struct counted items[256];
+   assert(batch <= 256);
+   collected = collected_sum = 0;
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   for (size_t i = 0; i < iters; i += batch) {
+      for (size_t x = 0; x < batch; ++x)
+         items[x] = (struct counted){ .index = i + x };
+
+      for (size_t added = 0; added < batch;) {
+         if (batch == 1) {
+            added += chck_tqueue_add_task(&tqueue, items, 0);
+         } else {
+            added += chck_tqueue_add_tasks(&tqueue, items + added, batch - added, 0);
+         }
+
+         if (added < batch)
+            chck_tqueue_collect(&tqueue);
+      }
+   }
+
+   while (chck_tqueue_collect(&tqueue));
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   assert(collected == iters);
+   chck_tqueue_release(&tqueue);
+
+   const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return iters / secs;
+}
+
+struct large {
+   size_t index;
+   uint8_t payload[4096 - sizeof(size_t)];
+};
+
+static void
+work_large(struct large *item)
+{
+   assert(item);
+   item->payload[0] = item->index & 0xFF;
+}
+
+static void
+callback_large(struct large *item)
+{
+   assert(item && item->payload[0] == (item->index & 0xFF));
+   ++collected;
+}
+
+static double
+bench_large(size_t iters, bool emplace)
+{
+   struct chck_tqueue tqueue;
+   assert(chck_tqueue(&tqueue, 2, 256, sizeof(struct large), work_large, callback_large, NULL));
+   chck_tqueue_set_keep_alive(&tqueue, true);
+   chck_tqueue_set_zeroing(&tqueue, !emplace);
+   collected = 0;
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   static struct large item;
+   for (size_t i = 0; i < iters; ++i) {
+      if (emplace) {
+         struct large *slot;
+         assert((slot = chck_tqueue_emplace_task(&tqueue, 1)));
+         slot->index = i;
+         assert(chck_tqueue_commit_task(&tqueue, slot));
+      } else {
+         item.index = i;
+         assert(chck_tqueue_add_task(&tqueue, &item, 1));
+      }
+   }
+
+   while (chck_tqueue_collect(&tqueue));
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   assert(collected == iters);
+   chck_tqueue_release(&tqueue);
+
+   const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return iters / secs;
+}
+
+struct producer {
+   struct chck_tqueue *tqueue;
+   size_t lane, base, count;
+   bool collect;
+};
+
+static size_t shared_collected, shared_sum;
+
+static void
+callback_shared(struct counted *item)
+{
+   assert(item);
+   assert(item->value == item->index * 2);
+   __atomic_add_fetch(&shared_sum, item->index, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&shared_collected, 1, __ATOMIC_RELAXED);
+}
+
+static void*
+produce(void *arg)
+{
+   struct producer *p = arg;
+
+   for (size_t i = 0; i < p->count; ++i) {
+      assert(chck_tqueue_add_lane_task(p->tqueue, p->lane, &(struct counted){ .index = p->base + i }, 1));
+
+      // Any thread may collect with MPMC scheduler.
+      if (p->collect && i % 16 == 0)
+         chck_tqueue_collect(p->tqueue);
+   }
+
+   return NULL;
+}
+
+static double
+bench_producers(enum chck_tqueue_scheduler scheduler, size_t nproducers, size_t iters)
+{
+   struct chck_tqueue tqueue;
+   assert(chck_tqueue(&tqueue, 2, 1024, sizeof(struct counted), work_counted, NULL, NULL));
+   assert(chck_tqueue_set_scheduler(&tqueue, scheduler));
+   chck_tqueue_set_keep_alive(&tqueue, true);
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   pthread_t threads[8];
+   struct producer producers[8];
+   assert(nproducers <= 8);
+   for (size_t i = 0; i < nproducers; ++i) {
+      producers[i] = (struct producer){ .tqueue = &tqueue, .base = i * iters, .count = iters };
+      assert(pthread_create(&threads[i], NULL, produce, &producers[i]) == 0);
+   }
+
+   for (size_t i = 0; i < nproducers; ++i)
+      pthread_join(threads[i], NULL);
+
+   // Collectless, wait until the workers are done.
+   while (true) {
+      pthread_mutex_lock(&tqueue.tasks.mutex);
+      const size_t count = tqueue.tasks.count;
+      pthread_mutex_unlock(&tqueue.tasks.mutex);
+
+      if (!count)
+         break;
+
+      usleep(100);
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   chck_tqueue_release(&tqueue);
+
+   const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return nproducers * iters / secs;
+}
+
+enum burst_mode {
+   BURST_RESTART,
+   BURST_PARK,
+   BURST_SPIN,
+};
+
+static double
+bench_bursts(enum burst_mode mode, size_t bursts)
+{
+   struct chck_tqueue tqueue;
+   assert(chck_tqueue(&tqueue, 4, 64, sizeof(struct counted), work_counted, callback_counted, NULL));
+   chck_tqueue_set_keep_alive(&tqueue, (mode != BURST_RESTART));
+   chck_tqueue_set_spin(&tqueue, (mode == BURST_SPIN ? 4096 : 0));
+   collected = collected_sum = 0;
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   struct counted items[8];
+   for (size_t i = 0; i < bursts; ++i) {
+      for (size_t x = 0; x < 8; ++x)
+         items[x] = (struct counted){ .index = x };
+
+      assert(chck_tqueue_add_tasks(&tqueue, items, 8, 1) == 8);
+      while (chck_tqueue_collect(&tqueue));
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   assert(collected == bursts * 8);
+   chck_tqueue_release(&tqueue);
+
+   const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return bursts / secs;
+}
+
+static double
+bench_tasks(enum chck_tqueue_scheduler scheduler, size_t nthreads, size_t iters)
+{
+   struct chck_tqueue tqueue;
+   assert(chck_tqueue(&tqueue, nthreads, 4096, sizeof(struct counted), work_counted, callback_counted, NULL));
+   assert(chck_tqueue_set_scheduler(&tqueue, scheduler));
+   chck_tqueue_set_keep_alive(&tqueue, true);
+
+   collected = collected_sum = 0;
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   for (size_t i = 0; i < iters; ++i) {
+      while (!chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0))
+         chck_tqueue_collect(&tqueue);
+   }
+
+   while (chck_tqueue_collect(&tqueue));
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   assert(collected == iters);
+   assert(collected_sum == iters * (iters - 1) / 2);
+   chck_tqueue_release(&tqueue);
+
+   const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return iters / secs;
+}
+
 int main(void)
 {
    /* TEST: thread pools */
@@ -109,6 +527,73 @@ int main(void)
 out:
       chck_tqueue_release(&tqueue);
    }
+
+   /* TEST: owned eventfd, coalesced notifications */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 1024, sizeof(struct counted), work_counted, callback_counted, NULL));
+
+      int fd;
+      assert((fd = chck_tqueue_create_eventfd(&tqueue)) >= 0);
+      assert(chck_tqueue_get_fd(&tqueue) == fd);
+
+      collected = collected_sum = 0;
+      for (size_t i = 0; i < 1000; ++i)
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0));
+
+      struct pollfd fds[1] = { { .fd = fd, .events = POLLIN } };
+      assert(poll(fds, 1, -1) == 1 && (fds[0].revents & POLLIN));
+
+      // all completions before collect are signaled with single write
+      usleep(10000);
+      uint64_t writes;
+      assert(read(fd, &writes, sizeof(writes)) == sizeof(writes));
+      assert(writes == 1);
+
+      // tasks completing after collect signal again
+      while (chck_tqueue_collect(&tqueue))
+         assert(poll(fds, 1, -1) == 1);
+
+      assert(collected == 1000 && collected_sum == 1000 * 999 / 2);
+      chck_tqueue_release(&tqueue);
+   }
+#endif
+
+#ifdef __linux__
+   /* TEST: worker options */
+   {
+      struct chck_tqueue tqueue;
+      const struct chck_tqueue_options options = {
+         .cpus = (int[]){ 0 },
+         .ncpus = 1,
+         .stack_size = 256 * 1024,
+         .name = "chck-tqueue-test",
+      };
+
+      assert(chck_tqueue_with_options(&tqueue, 1, 64, sizeof(struct counted), work_options, callback_counted, NULL, &options));
+
+      collected = collected_sum = 0;
+      for (size_t i = 0; i < 100; ++i)
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 1));
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 100 && collected_sum == 100 * 99 / 2);
+      chck_tqueue_release(&tqueue);
+
+      // cpu out of range, and numa node that does not exist
+      assert(!chck_tqueue_with_options(&tqueue, 1, 64, sizeof(struct counted), work_counted, callback_counted, NULL, &(struct chck_tqueue_options){ .cpus = (int[]){ -1 }, .ncpus = 1 }));
+      assert(!chck_tqueue_with_options(&tqueue, 1, 64, sizeof(struct counted), work_counted, callback_counted, NULL, &(struct chck_tqueue_options){ .use_numa_node = true, .numa_node = 4096 }));
+
+      if (chck_tqueue_with_options(&tqueue, 2, 64, sizeof(struct counted), work_counted, callback_counted, NULL, &(struct chck_tqueue_options){ .use_numa_node = true, .numa_node = 0 })) {
+         collected = 0;
+         for (size_t i = 0; i < 100; ++i)
+            assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 1));
+
+         while (chck_tqueue_collect(&tqueue)) usleep(100);
+         assert(collected == 100);
+         chck_tqueue_release(&tqueue);
+      }
+   }
 #endif
 
    /* TEST: throughput on single thread */
@@ -129,5 +614,642 @@ out:
       chck_tqueue_release(&tqueue);
    }
 
+   /* TEST: work stealing scheduler */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 1024, sizeof(struct counted), work_counted, callback_counted, NULL));
+      assert(chck_tqueue_get_scheduler(&tqueue) == CHCK_TQUEUE_SHARED);
+      assert(chck_tqueue_set_scheduler(&tqueue, CHCK_TQUEUE_WORK_STEALING));
+      assert(chck_tqueue_get_scheduler(&tqueue) == CHCK_TQUEUE_WORK_STEALING);
+
+      collected = collected_sum = 0;
+      for (size_t i = 0; i < 1000; ++i)
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0));
+
+      // scheduler can't be switched while tasks are in flight
+      assert(!chck_tqueue_set_scheduler(&tqueue, CHCK_TQUEUE_SHARED));
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 1000);
+      assert(collected_sum == 1000 * 999 / 2);
+
+      // and back to shared once drained
+      assert(chck_tqueue_set_scheduler(&tqueue, CHCK_TQUEUE_SHARED));
+      for (size_t i = 0; i < 1000; ++i)
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0));
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 2000);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: work stealing scheduler, no collect */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 64, sizeof(struct item), work, NULL, destructor));
+      assert(chck_tqueue_set_scheduler(&tqueue, CHCK_TQUEUE_WORK_STEALING));
+
+      for (size_t i = 0; i < 1000; ++i) {
+         struct item a = { 1, 10 };
+         assert(chck_tqueue_add_task(&tqueue, &a, 10));
+      }
+
+      // destructor expects processed items, wait for workers to drain the queue
+      for (size_t count = 1; count; usleep(100)) {
+         pthread_mutex_lock(&tqueue.tasks.mutex);
+         count = tqueue.tasks.count;
+         pthread_mutex_unlock(&tqueue.tasks.mutex);
+      }
+
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: batch submission */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 2, 100, sizeof(struct counted), work_counted, callback_counted, NULL));
+
+      struct counted items[250];
+      for (size_t i = 0; i < 250; ++i)
+         items[i] = (struct counted){ .index = i };
+
+      collected = collected_sum = 0;
+      assert(chck_tqueue_add_tasks(&tqueue, items, 0, 0) == 0);
+      assert(chck_tqueue_add_tasks(&tqueue, items, 70, 0) == 70);
+
+      // only as much as fits without blocking
+      assert(chck_tqueue_add_tasks(&tqueue, items + 70, 180, 0) == 30);
+
+      // blocking collects in between, batch wraps around the ring
+      assert(chck_tqueue_add_tasks(&tqueue, items + 100, 150, 10) == 150);
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 250);
+      assert(collected_sum == 250 * 249 / 2);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: blocking and timed submission */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 1, 1, sizeof(struct counted), work_slow, callback_counted, NULL));
+
+      collected = collected_sum = 0;
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 1 }, 0));
+      assert(!chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 2 }, 0));
+
+      // queue is full and the task takes 20ms, so short deadline expires
+      assert(!chck_tqueue_add_task_timed(&tqueue, &(struct counted){ .index = 2 }, 1000000));
+
+      // long enough deadline, creator thread collects the first task to make space
+      assert(chck_tqueue_add_task_timed(&tqueue, &(struct counted){ .index = 2 }, 1000000000));
+      assert(collected == 1);
+
+      // blocking waits for completion instead of polling
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 3 }, 1));
+      assert(collected == 2);
+
+      while (chck_tqueue_collect(&tqueue)) usleep(1000);
+      assert(collected == 3 && collected_sum == 6);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: completion order */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 2, 16, sizeof(struct counted), work_first_slow, callback_counted, NULL));
+      assert(chck_tqueue_get_order(&tqueue) == CHCK_TQUEUE_SUBMISSION_ORDER);
+      assert(chck_tqueue_set_order(&tqueue, CHCK_TQUEUE_COMPLETION_ORDER));
+
+      // slow first task does not hold back the rest, once the other worker picks them up
+      collected = collected_sum = 0;
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 0 }, 0));
+      usleep(10000);
+      for (size_t i = 1; i < 10; ++i)
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0));
+
+      assert(!chck_tqueue_set_order(&tqueue, CHCK_TQUEUE_SUBMISSION_ORDER));
+
+      while (collected < 9) {
+         assert(chck_tqueue_collect(&tqueue) > 0);
+         usleep(100);
+      }
+      assert(collected == 9 && collected_sum == 45);
+
+      while (chck_tqueue_collect(&tqueue)) usleep(1000);
+      assert(collected == 10 && collected_sum == 45);
+
+      // in submission order everything waits for the slow task
+      assert(chck_tqueue_set_order(&tqueue, CHCK_TQUEUE_SUBMISSION_ORDER));
+      collected = collected_sum = 0;
+      for (size_t i = 0; i < 10; ++i)
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0));
+
+      usleep(50000);
+      assert(chck_tqueue_collect(&tqueue) == 10 && collected == 0);
+
+      while (chck_tqueue_collect(&tqueue)) usleep(1000);
+      assert(collected == 10 && collected_sum == 45);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: priority lanes */
+   for (size_t quota = 0; quota < 2; ++quota) {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 1, 64, sizeof(struct counted), work_lane_low, callback_counted, NULL));
+      assert(chck_tqueue_get_lane_quota(&tqueue) > 0);
+      chck_tqueue_set_lane_quota(&tqueue, quota);
+      assert(chck_tqueue_get_lane_quota(&tqueue) == quota);
+
+      size_t lane;
+      assert(!chck_tqueue_add_lane(&tqueue, sizeof(struct counted) + 1, work_lane_high, callback_urgent, NULL, &lane));
+      assert(chck_tqueue_add_lane(&tqueue, sizeof(struct urgent), work_lane_high, callback_urgent, NULL, &lane));
+      assert(lane == 1);
+      assert(!chck_tqueue_add_lane_task(&tqueue, 2, &(struct urgent){ .index = 1 }, 0));
+
+      // keep the worker busy, while both lanes fill up
+      collected = collected_sum = urgent_collected = nran = 0;
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 0 }, 0));
+      usleep(5000);
+
+      for (size_t i = 1; i < 11; ++i)
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0));
+
+      struct urgent urgent[10] = {{0}};
+      assert(chck_tqueue_add_lane_tasks(&tqueue, lane, urgent, 10, 0) == 10);
+
+      while (chck_tqueue_collect(&tqueue)) usleep(1000);
+      assert(collected == 11 && collected_sum == 55 && urgent_collected == 10);
+      assert(nran == 21 && ran[0] == 0);
+
+      // without quota higher lane goes first, with quota of 1 lowest lane goes always first
+      for (size_t i = 1; i < 21; ++i)
+         assert(ran[i] == (quota == 1 ? i > 10 : i < 11));
+
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: priority lanes, work stealing scheduler */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 512, sizeof(struct counted), work_counted, callback_counted, NULL));
+      assert(chck_tqueue_set_scheduler(&tqueue, CHCK_TQUEUE_WORK_STEALING));
+
+      size_t lane;
+      assert(chck_tqueue_add_lane(&tqueue, sizeof(struct urgent), work_urgent, callback_urgent, NULL, &lane));
+
+      collected = collected_sum = urgent_collected = 0;
+      for (size_t i = 0; i < 1000; ++i) {
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 1));
+         assert(chck_tqueue_add_lane_task(&tqueue, lane, &(struct urgent){ .index = i }, 1));
+      }
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 1000 && collected_sum == 1000 * 999 / 2 && urgent_collected == 1000);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: blocking add to lane without callback, queue full of completed tasks of other lane */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 1, 4, sizeof(struct counted), work_counted, NULL, NULL));
+
+      size_t lane;
+      assert(chck_tqueue_add_lane(&tqueue, sizeof(struct urgent), work_urgent, callback_urgent, NULL, &lane));
+
+      urgent_collected = 0;
+      for (size_t i = 0; i < 4; ++i)
+         assert(chck_tqueue_add_lane_task(&tqueue, lane, &(struct urgent){ .index = i }, 0));
+
+      // completed tasks wait for collect, blocked creator has to make the space itself
+      usleep(10000);
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 4 }, 1));
+      assert(urgent_collected == 4);
+
+      while (chck_tqueue_collect(&tqueue)) usleep(1000);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: parallel for and reduce over pool items */
+   for (size_t scheduler = 0; scheduler < 2; ++scheduler) {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 64, sizeof(struct counted), work_counted, callback_counted, NULL));
+      assert(chck_tqueue_set_scheduler(&tqueue, (scheduler ? CHCK_TQUEUE_WORK_STEALING : CHCK_TQUEUE_SHARED)));
+
+      struct chck_iter_pool pool;
+      const size_t memb = 100000;
+      assert(chck_iter_pool(&pool, 0, memb, sizeof(size_t)));
+      for (size_t i = 0; i < memb; ++i)
+         assert(chck_iter_pool_push_back(&pool, &i));
+
+      assert(chck_parallel_for(&tqueue, 0, memb, 64, square_items, &pool));
+      for (size_t i = 0; i < memb; ++i)
+         assert(*(size_t*)chck_iter_pool_get(&pool, i) == i * i);
+
+      size_t sum = 0, expected = 0;
+      for (size_t i = 0; i < memb; ++i)
+         expected += i * i;
+
+      assert(chck_parallel_reduce(&tqueue, 0, memb, 64, &sum, sizeof(sum), sum_items, sum_combine, &pool));
+      assert(sum == expected);
+
+      // empty range, and range that fits single chunk
+      sum = 0;
+      assert(chck_parallel_reduce(&tqueue, 10, 10, 64, &sum, sizeof(sum), sum_items, sum_combine, &pool));
+      assert(sum == 0);
+      assert(chck_parallel_reduce(&tqueue, 1, 4, 64, &sum, sizeof(sum), sum_items, sum_combine, &pool));
+      assert(sum == 1 + 4 + 9);
+
+      // regular tasks still work in between
+      collected = collected_sum = 0;
+      for (size_t i = 0; i < 100; ++i) {
+         assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 1));
+         if (i % 10 == 0) {
+            sum = 0;
+            assert(chck_parallel_reduce(&tqueue, 0, memb, 0, &sum, sizeof(sum), sum_items, sum_combine, &pool));
+            assert(sum == expected);
+         }
+      }
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 100 && collected_sum == 100 * 99 / 2);
+
+      chck_iter_pool_release(&pool);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: continuations and dependency graph */
+   for (size_t mode = 0; mode < 4; ++mode) {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 256, sizeof(struct staged), work_staged, callback_staged, NULL));
+      assert(chck_tqueue_set_scheduler(&tqueue, ((mode & 1) ? CHCK_TQUEUE_WORK_STEALING : CHCK_TQUEUE_SHARED)));
+      assert(chck_tqueue_set_order(&tqueue, ((mode & 2) ? CHCK_TQUEUE_COMPLETION_ORDER : CHCK_TQUEUE_SUBMISSION_ORDER)));
+
+      // decode -> transform -> compress chains, each stage runs only after the previous one
+      size_t counters[32] = {0};
+      struct chck_tqueue_task tasks[32];
+      staged_collected = 0;
+      for (size_t i = 0; i < 32; ++i)
+         assert(chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct staged){ &counters[i], 0 }, NULL, 0, 1, &tasks[i]));
+
+      for (size_t stage = 1; stage < 3; ++stage) {
+         for (size_t i = 0; i < 32; ++i)
+            assert(chck_tqueue_then(&tqueue, &tasks[i], 0, &(struct staged){ &counters[i], stage }, 1, &tasks[i]));
+      }
+
+      // diamond, d waits for c which waits for both a and b
+      size_t diamond = 0;
+      struct chck_tqueue_task a, b, c, d;
+      assert(chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct staged){ &diamond, 0 }, NULL, 0, 1, &a));
+      assert(chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct staged){ &diamond, 0 }, NULL, 0, 1, &b));
+      assert(chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct staged){ &diamond, 2 }, (struct chck_tqueue_task[]){ a, b }, 2, 1, &c));
+      assert(chck_tqueue_then(&tqueue, &c, 0, &(struct staged){ &diamond, 3 }, 1, &d));
+
+      assert(!chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct staged){ &diamond, 0 }, (struct chck_tqueue_task[CHCK_TQUEUE_MAX_DEPS + 1]){{0}}, CHCK_TQUEUE_MAX_DEPS + 1, 1, &d));
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(staged_collected == 32 * 3 + 4);
+      assert(diamond == 4);
+      for (size_t i = 0; i < 32; ++i)
+         assert(counters[i] == 3 && chck_tqueue_task_done(&tqueue, &tasks[i]));
+
+      // dependency that is already collected, is done
+      assert(chck_tqueue_then(&tqueue, &d, 0, &(struct staged){ &diamond, 4 }, 1, &d));
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(diamond == 5 && chck_tqueue_task_done(&tqueue, &d));
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: emplace */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 2, 8, sizeof(struct counted), work_counted, callback_counted, NULL));
+      assert(chck_tqueue_get_zeroing(&tqueue));
+
+      collected = collected_sum = 0;
+      struct counted *slots[8];
+      for (size_t i = 0; i < 8; ++i) {
+         assert((slots[i] = chck_tqueue_emplace_task(&tqueue, 0)));
+         assert(slots[i]->index == 0 && slots[i]->value == 0);
+         slots[i]->index = i;
+      }
+
+      // all slots are reserved, until committed or discarded
+      assert(!chck_tqueue_emplace_task(&tqueue, 0));
+      assert(!chck_tqueue_commit_task(&tqueue, (uint8_t*)slots[0] + 1));
+      assert(chck_tqueue_discard_task(&tqueue, slots[7]));
+
+      // discarded slot can't be committed or discarded again
+      assert(!chck_tqueue_commit_task(&tqueue, slots[7]));
+      assert(!chck_tqueue_discard_task(&tqueue, slots[7]));
+
+      for (size_t i = 0; i < 7; ++i)
+         assert(chck_tqueue_commit_task(&tqueue, slots[i]));
+
+      // nor committed twice
+      assert(!chck_tqueue_commit_task(&tqueue, slots[0]));
+      assert(!chck_tqueue_discard_task(&tqueue, slots[6]));
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 7 && collected_sum == 21);
+      chck_tqueue_release(&tqueue);
+
+      // without zeroing, slot has the data of previous task
+      assert(chck_tqueue(&tqueue, 1, 1, sizeof(struct counted), work_counted, callback_counted, NULL));
+      chck_tqueue_set_zeroing(&tqueue, false);
+      assert(!chck_tqueue_get_zeroing(&tqueue));
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 7 }, 0));
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+
+      struct counted *slot;
+      assert((slot = chck_tqueue_emplace_task(&tqueue, 0)));
+      assert(slot->index == 7 && slot->value == 14);
+      assert(chck_tqueue_commit_task(&tqueue, slot));
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 9);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: async tasks and cancellation */
+   for (size_t s = 0; s < 2; ++s) {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 1, 8, sizeof(struct counted), work_first_slow, callback_counted, destructor_counted));
+      assert(chck_tqueue_set_scheduler(&tqueue, (s ? CHCK_TQUEUE_WORK_STEALING : CHCK_TQUEUE_SHARED)));
+
+      struct resumed resumed = {0};
+      const struct chck_tqueue_continuation continuation = { resume_counted, &resumed };
+      collected = collected_sum = destructed = 0;
+
+      // single worker is busy with the first task, rest are still queued
+      struct chck_tqueue_task tasks[3];
+      for (size_t i = 0; i < 3; ++i)
+         assert(chck_tqueue_add_lane_task_async(&tqueue, 0, &(struct counted){ .index = i }, 0, &continuation, &tasks[i]));
+
+      usleep(50000);
+      assert(!chck_tqueue_cancel_task(&tqueue, &tasks[0]));
+      assert(chck_tqueue_cancel_task(&tqueue, &tasks[1]));
+      assert(!chck_tqueue_cancel_task(&tqueue, &tasks[1]));
+
+      // cancelled task skips work and callback, but is resumed and destructed
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(resumed.count == 3 && resumed.cancelled == 1 && resumed.sum == 2);
+      assert(collected == 2 && collected_sum == 2 && destructed == 3);
+      assert(!chck_tqueue_cancel_task(&tqueue, &tasks[2]));
+
+      // dependents of cancelled task are cancelled with it, all the way down the chain
+      struct chck_tqueue_task first, chain[3];
+      collected = collected_sum = destructed = 0;
+      assert(chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct counted){ .index = 0 }, NULL, 0, 0, &first));
+      assert(chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct counted){ .index = 1 }, NULL, 0, 0, &chain[0]));
+      for (size_t i = 1; i < 3; ++i)
+         assert(chck_tqueue_then(&tqueue, &chain[i - 1], 0, &(struct counted){ .index = i + 1 }, 0, &chain[i]));
+
+      usleep(50000);
+      assert(chck_tqueue_cancel_task(&tqueue, &chain[0]));
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(collected == 1 && collected_sum == 0 && destructed == 4);
+      for (size_t i = 0; i < 3; ++i)
+         assert(chck_tqueue_task_done(&tqueue, &chain[i]));
+
+      // continuation of task never collected is resumed as cancelled on release
+      assert(chck_tqueue_add_lane_task_async(&tqueue, 0, &(struct counted){ .index = 0 }, 0, &continuation, NULL));
+      chck_tqueue_release(&tqueue);
+      assert(resumed.count == 4 && resumed.cancelled == 2 && destructed == 5);
+   }
+
+#ifdef __linux__
+   /* TEST: async tasks on lane without callback, resumed through fd */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 2, 4, sizeof(struct counted), work_counted, NULL, destructor_counted));
+
+      int fd;
+      assert((fd = chck_tqueue_create_eventfd(&tqueue)) >= 0);
+
+      struct resumed resumed = {0};
+      const struct chck_tqueue_continuation continuation = { resume_counted, &resumed };
+      destructed = 0;
+
+      // creator collects by itself when queue is full
+      for (size_t i = 0; i < 16; ++i)
+         assert(chck_tqueue_add_lane_task_async(&tqueue, 0, &(struct counted){ .index = i }, 1, &continuation, NULL));
+
+      struct pollfd fds[1] = { { .fd = fd, .events = POLLIN } };
+      while (resumed.count < 16) {
+         assert(poll(fds, 1, -1) == 1);
+         chck_tqueue_collect(&tqueue);
+      }
+
+      assert(resumed.sum == 16 * 15 / 2 && !resumed.cancelled && destructed == 16);
+      chck_tqueue_release(&tqueue);
+   }
+#endif
+
+   /* TEST: elastic workers */
+   for (size_t s = 0; s < 2; ++s) {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 64, sizeof(struct counted), work_slow, callback_counted, NULL));
+      assert(chck_tqueue_set_scheduler(&tqueue, (s ? CHCK_TQUEUE_WORK_STEALING : CHCK_TQUEUE_SHARED)));
+      assert(chck_tqueue_get_min_threads(&tqueue) == 4);
+      assert(!chck_tqueue_set_min_threads(&tqueue, 5));
+      assert(chck_tqueue_set_min_threads(&tqueue, 1));
+      chck_tqueue_set_idle_timeout(&tqueue, 20 * 1000000);
+      assert(chck_tqueue_get_idle_timeout(&tqueue) == 20 * 1000000);
+      chck_tqueue_set_spin(&tqueue, 128);
+      assert(chck_tqueue_get_spin(&tqueue) == 128 || sysconf(_SC_NPROCESSORS_ONLN) <= 1);
+      chck_tqueue_set_keep_alive(&tqueue, true);
+      assert(chck_tqueue_get_threads(&tqueue) == 0);
+
+      for (size_t round = 0; round < 2; ++round) {
+         // burst of slow tasks grows the pool up to its maximum
+         collected = collected_sum = 0;
+         for (size_t i = 0; i < 16; ++i)
+            assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 1));
+
+         size_t most = 0;
+         while (chck_tqueue_collect(&tqueue)) {
+            const size_t alive = chck_tqueue_get_threads(&tqueue);
+            most = (alive > most ? alive : most);
+            usleep(1000);
+         }
+
+         assert(collected == 16 && collected_sum == 120);
+         assert(most > 1 && most <= 4);
+
+         // idle workers exit down to min
+         for (size_t i = 0; i < 500 && chck_tqueue_get_threads(&tqueue) > 1; ++i)
+            usleep(1000);
+         assert(chck_tqueue_get_threads(&tqueue) == 1);
+      }
+
+      // without min every worker exits, and they come back with new tasks
+      assert(chck_tqueue_set_min_threads(&tqueue, 0));
+      for (size_t i = 0; i < 500 && chck_tqueue_get_threads(&tqueue) > 0; ++i)
+         usleep(1000);
+      assert(chck_tqueue_get_threads(&tqueue) == 0);
+
+      collected = collected_sum = 0;
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 3 }, 1));
+      while (chck_tqueue_collect(&tqueue)) usleep(1000);
+      assert(collected == 1 && collected_sum == 3);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: MPMC scheduler, many producers and collectors */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 4, 32, sizeof(struct counted), work_counted, callback_shared, NULL));
+
+      size_t collectless;
+      assert(chck_tqueue_add_lane(&tqueue, sizeof(struct counted), work_counted, NULL, NULL, &collectless));
+      assert(chck_tqueue_set_scheduler(&tqueue, CHCK_TQUEUE_MPMC));
+      assert(chck_tqueue_get_scheduler(&tqueue) == CHCK_TQUEUE_MPMC);
+      assert(chck_tqueue_get_order(&tqueue) == CHCK_TQUEUE_COMPLETION_ORDER);
+      assert(!chck_tqueue_set_order(&tqueue, CHCK_TQUEUE_SUBMISSION_ORDER));
+
+      // dependencies are not supported
+      struct chck_tqueue_task task;
+      assert(!chck_tqueue_add_lane_task_after(&tqueue, 0, &(struct counted){0}, NULL, 0, 0, &task));
+
+      shared_collected = shared_sum = 0;
+      pthread_t threads[4];
+      struct producer producers[4];
+      for (size_t i = 0; i < 4; ++i) {
+         producers[i] = (struct producer){ .tqueue = &tqueue, .lane = (i == 3 ? collectless : 0), .base = i * 1000, .count = 1000, .collect = true };
+         assert(pthread_create(&threads[i], NULL, produce, &producers[i]) == 0);
+      }
+
+      for (size_t i = 0; i < 4; ++i)
+         pthread_join(threads[i], NULL);
+
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(shared_collected == 3000 && shared_sum == 3 * 999 * 1000 / 2 + 1000 * (1000 + 2000));
+
+      // emplace and discard go through the rings as well
+      struct counted *slot;
+      assert((slot = chck_tqueue_emplace_task(&tqueue, 1)));
+      slot->index = 5;
+      assert(chck_tqueue_commit_task(&tqueue, slot));
+      assert(!chck_tqueue_commit_task(&tqueue, slot));
+      assert((slot = chck_tqueue_emplace_task(&tqueue, 1)));
+      assert(chck_tqueue_discard_task(&tqueue, slot));
+      assert(!chck_tqueue_commit_task(&tqueue, slot));
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(shared_collected == 3001);
+
+      // free slots move back to the stack when switching away
+      assert(chck_tqueue_set_scheduler(&tqueue, CHCK_TQUEUE_SHARED));
+      assert(tqueue.tasks.nunused == 32);
+      assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = 1 }, 1));
+      while (chck_tqueue_collect(&tqueue)) usleep(100);
+      assert(shared_collected == 3002);
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: statistics */
+   {
+      struct chck_tqueue tqueue;
+      assert(chck_tqueue(&tqueue, 2, 4, sizeof(struct counted), work_slow, callback_counted, NULL));
+
+      struct chck_tqueue_stats stats;
+      const bool enabled = chck_tqueue_get_stats(&tqueue, &stats);
+#if HAS_TQUEUE_STATS
+      assert(enabled);
+#else
+      assert(!enabled && !stats.dispatched);
+      assert(!chck_tqueue_get_worker_stats(&tqueue, (struct chck_tqueue_worker_stats[2]){{0}}, 2));
+#endif
+
+      collected = collected_sum = 0;
+      for (size_t i = 0; i < 8;) {
+         if (chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 0)) {
+            ++i;
+         } else {
+            chck_tqueue_collect(&tqueue);
+            usleep(1000);
+         }
+      }
+
+      while (chck_tqueue_collect(&tqueue)) usleep(1000);
+      assert(collected == 8);
+
+      if (enabled) {
+         assert(chck_tqueue_get_stats(&tqueue, &stats));
+         assert(stats.dispatched == 8 && stats.completed == 8);
+         assert(stats.full > 0 && stats.blocked == 0);
+         assert(stats.depth == 0 && stats.max_depth == 4 && stats.depth_ns > 0);
+         assert(stats.wait.count == 8 && stats.collect.count == 8);
+         assert(stats.work.count == 8 && stats.work.max_ns >= 20000000 && stats.work.sum_ns >= 8 * 20000000);
+         assert(stats.collect.max_ns >= stats.work.max_ns);
+
+         uint64_t sum = 0;
+         for (size_t i = 0; i < CHCK_TQUEUE_HISTOGRAM_BUCKETS; ++i)
+            sum += stats.work.buckets[i];
+         assert(sum == 8);
+
+         struct chck_tqueue_worker_stats workers[4];
+         assert(chck_tqueue_get_worker_stats(&tqueue, workers, 4) == 2);
+         assert(workers[0].tasks + workers[1].tasks == 8);
+         assert(workers[0].busy_ns + workers[1].busy_ns == stats.work.sum_ns);
+         assert(workers[0].busy_ns <= stats.elapsed_ns && workers[1].busy_ns <= stats.elapsed_ns);
+
+         chck_tqueue_reset_stats(&tqueue);
+         assert(chck_tqueue_get_stats(&tqueue, &stats));
+         assert(!stats.dispatched && !stats.completed && !stats.full && !stats.work.count && !stats.max_depth);
+
+         // blocking add on full queue
+         for (size_t i = 0; i < 5; ++i)
+            assert(chck_tqueue_add_task(&tqueue, &(struct counted){ .index = i }, 1));
+
+         while (chck_tqueue_collect(&tqueue)) usleep(1000);
+         assert(chck_tqueue_get_stats(&tqueue, &stats));
+         assert(stats.full > 0 && stats.blocked == stats.full && stats.completed == 5);
+      }
+
+      chck_tqueue_release(&tqueue);
+   }
+
+   /* TEST: benchmark (bursts with restarted, parked and spinning workers) */
+   {
+      const size_t bursts = 0x7FF;
+      printf("tqueue: bursts, restart: %10.0f bursts/s\n", bench_bursts(BURST_RESTART, bursts));
+      printf("tqueue: bursts, park:    %10.0f bursts/s\n", bench_bursts(BURST_PARK, bursts));
+      printf("tqueue: bursts, spin:    %10.0f bursts/s\n", bench_bursts(BURST_SPIN, bursts));
+   }
+
+   /* TEST: benchmark (many producers, shared vs MPMC scheduler) */
+   {
+      const size_t iters = 0x3FFF;
+      for (size_t nproducers = 1; nproducers <= 4; nproducers *= 2) {
+         const double shared = bench_producers(CHCK_TQUEUE_SHARED, nproducers, iters);
+         const double mpmc = bench_producers(CHCK_TQUEUE_MPMC, nproducers, iters);
+         printf("tqueue: %zu producers, shared: %10.0f tasks/s, mpmc: %10.0f tasks/s\n", nproducers, shared, mpmc);
+      }
+   }
+
+   /* TEST: benchmark (copy vs emplace of 4KiB tasks) */
+   {
+      const size_t iters = 0x7FFF;
+      printf("tqueue: 4KiB tasks, copy and zero: %10.0f tasks/s\n", bench_large(iters, false));
+      printf("tqueue: 4KiB tasks, emplace:       %10.0f tasks/s\n", bench_large(iters, true));
+   }
+
+   /* TEST: benchmark (single vs batch submission) */
+   {
+      const size_t iters = 0x1FFFF;
+      for (size_t batch = 1; batch <= 256; batch *= 16)
+         printf("tqueue: submit batch of %3zu: %10.0f tasks/s\n", batch, bench_submit(4, iters - iters % batch, batch));
+   }
+
+   /* TEST: benchmark (tasks/sec across thread counts and schedulers) */
+   {
+      const size_t iters = 0xFFFF;
+      for (size_t nthreads = 1; nthreads <= 16; nthreads *= 2) {
+         const double shared = bench_tasks(CHCK_TQUEUE_SHARED, nthreads, iters);
+         const double stealing = bench_tasks(CHCK_TQUEUE_WORK_STEALING, nthreads, iters);
+         printf("tqueue: %2zu threads, shared: %10.0f tasks/s, work stealing: %10.0f tasks/s\n", nthreads, shared, stealing);
+      }
+   }
+
    return EXIT_SUCCESS;
 }